@@ -0,0 +1,611 @@
+/*
+ * Copyright(c) 2018 Tim Ruehsen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * This file is part of libhsts.
+ *
+ * Structure and cost analysis of a DAFSA
+ *
+ * A node is a position in the graph that is the target of a link. It consists
+ * of a label (one or more characters) and is either followed by a list of
+ * links (offsets) to its children or by a return value. See hsts-make-dafsa
+ * for the format.
+ *
+ * Bytes touched per lookup are modelled by replaying the byte accesses of
+ * LookupStringInFixedSet() for each label suffix of a host, as hsts_search()
+ * does, until a suffix is found.
+ *
+ * All state is kept per node or in bitmaps, not per graph byte, so that
+ * multi-million entry graphs can be analyzed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CACHE_LINE_SIZE 64
+#define MAX_DEPTH 256
+#define MAX_KEY_LENGTH 256
+
+/* same as HSTS_FLAG_INCLUDE_SUBDOMAINS in the return value */
+#define FLAG_INCLUDE_SUBDOMAINS 1
+
+#define TEST_BIT(map, n) ((map)[(n) >> 3] & (1 << ((n) & 7)))
+#define SET_BIT(map, n) ((map)[(n) >> 3] |= (unsigned char) (1 << ((n) & 7)))
+#define CLEAR_BIT(map, n) ((map)[(n) >> 3] &= (unsigned char) ~(1 << ((n) & 7)))
+
+/* nodes in breadth-first order */
+struct walk {
+	unsigned char
+		*visited; /* bitmap over the graph bytes */
+	size_t
+		*pos; /* position of the node */
+	int32_t
+		*depth; /* shortest distance from the source in nodes */
+	size_t
+		nnodes,
+		size;
+};
+
+struct node_info {
+	uint32_t
+		longest_bytes, /* longest path to the sink in label bytes */
+		longest_nodes; /* longest path to the sink in nodes */
+	uint64_t
+		entries; /* number of paths to the sink */
+};
+
+struct histogram {
+	uint64_t
+		*count;
+	size_t
+		size;
+};
+
+static int Count(struct histogram *h, size_t value)
+{
+	if (value >= h->size) {
+		size_t size = value + 16;
+		uint64_t *tmp = realloc(h->count, size * sizeof(uint64_t));
+
+		if (!tmp)
+			return -1;
+
+		memset(tmp + h->size, 0, (size - h->size) * sizeof(uint64_t));
+		h->count = tmp;
+		h->size = size;
+	}
+
+	h->count[value]++;
+	return 0;
+}
+
+static void PrintHistogram(FILE *fp, const struct histogram *h)
+{
+	size_t it;
+	int first = 1;
+
+	fputc('{', fp);
+	for (it = 0; it < h->size; it++) {
+		if (h->count[it]) {
+			fprintf(fp, "%s\"%zu\": %llu", first ? "" : ", ", it, (unsigned long long) h->count[it]);
+			first = 0;
+		}
+	}
+	fputc('}', fp);
+}
+
+/*
+ * Reads the link at |*pos| and adds it to |*target|, see GetNextOffset().
+ * Returns the width of the link in bytes, 0 on malformed data.
+ * |*last| is set if this is the last link in the list.
+ */
+static int NextLink(const unsigned char *graph, size_t length, int wide, size_t *pos, size_t *target, int *last)
+{
+	size_t p = *pos;
+	int width;
+
+	if (p >= length)
+		return 0;
+
+	switch (graph[p] & 0x60) {
+	case 0x60:
+		if (wide && (graph[p] & 0x10)) {
+			uint64_t value;
+
+			if (p + 4 >= length)
+				return 0;
+			value = ((uint64_t) (graph[p] & 0x0F) << 32) | ((uint64_t) graph[p + 1] << 24)
+				| (graph[p + 2] << 16) | (graph[p + 3] << 8) | graph[p + 4];
+			if (value >= length)
+				return 0;
+			*target += (size_t) value;
+			width = 5;
+			break;
+		}
+		if (p + 2 >= length)
+			return 0;
+		*target += ((graph[p] & (wide ? 0x0F : 0x1F)) << 16) | (graph[p + 1] << 8) | graph[p + 2];
+		width = 3;
+		break;
+	case 0x40:
+		if (p + 1 >= length)
+			return 0;
+		*target += ((graph[p] & 0x1F) << 8) | graph[p + 1];
+		width = 2;
+		break;
+	default:
+		*target += graph[p] & 0x3F;
+		width = 1;
+	}
+
+	*last = (graph[p] & 0x80) != 0;
+	*pos = p + width;
+
+	/* links always point forward, beyond the link itself */
+	return *target >= *pos && *target < length ? width : 0;
+}
+
+/*
+ * Parses the label of the node at |pos|. Returns the number of label bytes,
+ * -1 on malformed data. |*links| receives the position of the link list or 0
+ * if the label ends with a return value.
+ */
+static int ParseLabel(const unsigned char *graph, size_t length, size_t pos, size_t *links)
+{
+	size_t it;
+
+	for (it = pos; it < length; it++) {
+		if ((graph[it] & 0xF0) == 0x80) {
+			*links = 0; /* <return value> */
+			return (int) (it - pos);
+		}
+
+		if (graph[it] & 0x80) {
+			*links = it + 1; /* <end_char> */
+			return (int) (it + 1 - pos);
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Transcodes UTF-8 multibyte sequences of |key| into the graph representation
+ * (0x1F, leading byte ^ 0x80, following bytes ^ 0xC0), see hsts-make-dafsa.
+ * Returns the length of the transcoded key, -1 if it can't match.
+ */
+static int Transcode(const char *key, size_t key_length, int utf_mode, unsigned char *buf, size_t size)
+{
+	size_t it, n = 0;
+
+	for (it = 0; it < key_length; it++) {
+		unsigned char c = (unsigned char) key[it];
+		int cont;
+
+		if (c < 0x80) {
+			if (n >= size)
+				return -1;
+			buf[n++] = c;
+			continue;
+		}
+
+		cont = c < 0xC0 ? -1 : c < 0xE0 ? 1 : c < 0xF0 ? 2 : c < 0xF8 ? 3 : -1;
+		if (!utf_mode || cont < 0 || key_length - it <= (size_t) cont || n + 2 + cont > size)
+			return -1;
+
+		buf[n++] = 0x1F;
+		buf[n++] = c ^ 0x80;
+		while (cont--) {
+			if (((c = (unsigned char) key[++it]) & 0xC0) != 0x80)
+				return -1;
+			buf[n++] = c ^ 0xC0;
+		}
+	}
+
+	return (int) n;
+}
+
+/*
+ * Adds the node at |pos| with |depth| if it wasn't visited yet.
+ * Returns 0 on success, -1 if out of memory.
+ */
+static int Visit(struct walk *w, size_t pos, int32_t depth)
+{
+	if (TEST_BIT(w->visited, pos))
+		return 0;
+
+	if (w->nnodes >= w->size) {
+		size_t size = w->size ? w->size * 2 : 1024, *tmp_pos;
+		int32_t *tmp_depth;
+
+		if (!(tmp_pos = realloc(w->pos, size * sizeof(size_t))))
+			return -1;
+		w->pos = tmp_pos;
+
+		if (!(tmp_depth = realloc(w->depth, size * sizeof(int32_t))))
+			return -1;
+		w->depth = tmp_depth;
+
+		w->size = size;
+	}
+
+	SET_BIT(w->visited, pos);
+	w->pos[w->nnodes] = pos;
+	w->depth[w->nnodes++] = depth;
+	return 0;
+}
+
+/* Returns the index of the node at |pos| in |nodes|, sorted descending. */
+static size_t FindNode(const size_t *nodes, size_t nnodes, size_t pos)
+{
+	size_t lo = 0, hi = nnodes;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (nodes[mid] > pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* distinct bytes and cache lines touched by one lookup */
+struct trace_ctx {
+	unsigned char
+		*byte_seen, /* bitmaps, reset after each lookup */
+		*line_seen;
+	size_t
+		*touched, /* positions set in byte_seen */
+		ntouched,
+		size;
+	uint64_t
+		bytes,
+		lines;
+	int
+		nomem;
+};
+
+static void Touch(struct trace_ctx *ctx, size_t pos)
+{
+	if (TEST_BIT(ctx->byte_seen, pos))
+		return;
+
+	if (ctx->ntouched >= ctx->size) {
+		size_t size = ctx->size ? ctx->size * 2 : 256, *tmp;
+
+		if (!(tmp = realloc(ctx->touched, size * sizeof(size_t)))) {
+			ctx->nomem = 1;
+			return;
+		}
+
+		ctx->touched = tmp;
+		ctx->size = size;
+	}
+
+	SET_BIT(ctx->byte_seen, pos);
+	ctx->touched[ctx->ntouched++] = pos;
+	ctx->bytes++;
+
+	if (!TEST_BIT(ctx->line_seen, pos / CACHE_LINE_SIZE)) {
+		SET_BIT(ctx->line_seen, pos / CACHE_LINE_SIZE);
+		ctx->lines++;
+	}
+}
+
+/* every touched cache line contains a touched byte */
+static void ResetTrace(struct trace_ctx *ctx)
+{
+	while (ctx->ntouched) {
+		size_t pos = ctx->touched[--ctx->ntouched];
+
+		CLEAR_BIT(ctx->byte_seen, pos);
+		CLEAR_BIT(ctx->line_seen, pos / CACHE_LINE_SIZE);
+	}
+}
+
+/*
+ * Replays the byte accesses of a lookup of |key| (transcoded).
+ * Returns the return value if |key| was found, else -1.
+ */
+static int TraceLookup(const unsigned char *graph, size_t length, int wide, size_t index_length,
+	const unsigned char *key, size_t key_length, struct trace_ctx *ctx)
+{
+	size_t pos = 0, target = 0, k = 0;
+	int last = 0;
+
+	while (!last) {
+		size_t child, link = pos, it;
+
+		if (!NextLink(graph, length, wide, &pos, &target, &last))
+			return -1;
+
+		for (it = link; it < pos; it++)
+			Touch(ctx, it);
+
+		child = target;
+		Touch(ctx, child);
+
+		if ((graph[child] & 0xF0) == 0x80) {
+			/* <return value> */
+			if (k == key_length) {
+				for (it = 1; it <= index_length && child + it < length; it++)
+					Touch(ctx, child + it);
+				return graph[child] & 0x0F;
+			}
+			continue;
+		}
+
+		if (k == key_length || (graph[child] & 0x7F) != key[k])
+			continue; /* try the next child */
+
+		/* the first character matches, the rest of the label has to match */
+		for (;;) {
+			k++;
+
+			if (graph[child] & 0x80) {
+				/* <end_char>, dive into the child */
+				pos = target = child + 1;
+				last = 0;
+				break;
+			}
+
+			if (++child >= length)
+				return -1;
+			Touch(ctx, child);
+
+			if ((graph[child] & 0xF0) == 0x80) {
+				if (k != key_length)
+					return -1;
+				for (it = 1; it <= index_length && child + it < length; it++)
+					Touch(ctx, child + it);
+				return graph[child] & 0x0F;
+			}
+
+			if (k == key_length || (graph[child] & 0x7F) != key[k])
+				return -1;
+		}
+	}
+
+	return -1;
+}
+
+static int CompareSize(const void *a, const void *b)
+{
+	size_t x = *(const size_t *) a, y = *(const size_t *) b;
+
+	return x < y ? 1 : x > y ? -1 : 0; /* descending */
+}
+
+/* prototype to skip warning with -Wmissing-prototypes */
+int AnalyzeFixedSet(const unsigned char *, size_t, int, size_t, int, int, const char *const *, size_t, FILE *);
+
+/*
+ * Writes a JSON report about the structure of |graph| and the modelled cost of
+ * looking up |hosts| to |fp|. |version| is the format version of |graph|, it is
+ * only reported. Each return value is followed by |index_length| bytes (the
+ * record index), |wide| is set for graphs with wide offsets.
+ * Returns 0 on success, -1 on malformed data, -2 if out of memory.
+ */
+int AnalyzeFixedSet(const unsigned char *graph, size_t length, int version, size_t index_length, int wide,
+	int nrecords, const char *const *hosts, size_t nhosts, FILE *fp)
+{
+	struct walk walk = { NULL, NULL, NULL, 0, 0 };
+	struct node_info *info = NULL;
+	struct histogram label_length = { NULL, 0 }, fanout[MAX_DEPTH], offsets = { NULL, 0 };
+	struct trace_ctx trace = { NULL, NULL, NULL, 0, 0, 0, 0, 0 };
+	size_t head = 0, pos, target, it, end_nodes = 0, max_depth = 0, matched = 0;
+	size_t links = 0;
+	uint64_t entries = 0;
+	uint32_t longest_bytes = 0, longest_nodes = 0;
+	int utf_mode = length > 0 && graph[length - 1] < 0x80, last, width, rc = -2;
+
+	memset(fanout, 0, sizeof(fanout));
+
+	if (!(walk.visited = calloc(length / 8 + 1, 1)))
+		goto out;
+
+	rc = -1;
+
+	/* breadth-first walk from the source, which is a list of links at position 0 */
+	for (pos = target = 0, last = 0; !last;) {
+		if (!NextLink(graph, length, wide, &pos, &target, &last))
+			goto out;
+
+		if (Visit(&walk, target, 1))
+			goto nomem;
+	}
+
+	while (head < walk.nnodes) {
+		size_t node = walk.pos[head], nlinks = 0;
+		int32_t depth = walk.depth[head++];
+		int label;
+
+		if ((label = ParseLabel(graph, length, node, &links)) < 0)
+			goto out;
+
+		if (Count(&label_length, (size_t) label))
+			goto nomem;
+
+		if ((size_t) depth > max_depth)
+			max_depth = (size_t) depth;
+
+		if (!links) {
+			end_nodes++;
+			if (node + label + index_length >= length)
+				goto out;
+			continue;
+		}
+
+		for (pos = target = links, last = 0; !last; nlinks++) {
+			if (!(width = NextLink(graph, length, wide, &pos, &target, &last)))
+				goto out;
+
+			if (Count(&offsets, (size_t) width))
+				goto nomem;
+
+			if (Visit(&walk, target, depth + 1))
+				goto nomem;
+		}
+
+		if (Count(&fanout[depth < MAX_DEPTH ? depth : MAX_DEPTH - 1], nlinks))
+			goto nomem;
+	}
+
+	free(walk.depth);
+	walk.depth = NULL;
+	free(walk.visited);
+	walk.visited = NULL;
+
+	/* all links point forward: compute the path statistics from the end of the graph */
+	qsort(walk.pos, walk.nnodes, sizeof(size_t), CompareSize);
+
+	if (!(info = malloc((walk.nnodes + 1) * sizeof(struct node_info))))
+		goto nomem;
+
+	for (it = 0; it < walk.nnodes; it++) {
+		struct node_info *n = &info[it];
+		int label = ParseLabel(graph, length, walk.pos[it], &links);
+
+		n->entries = 0;
+		n->longest_bytes = n->longest_nodes = 0;
+
+		if (!links) {
+			n->entries = 1;
+		} else {
+			for (pos = target = links, last = 0; !last;) {
+				struct node_info *child;
+
+				NextLink(graph, length, wide, &pos, &target, &last);
+				child = &info[FindNode(walk.pos, it, target)];
+				n->entries += child->entries;
+				if (child->longest_bytes > n->longest_bytes)
+					n->longest_bytes = child->longest_bytes;
+				if (child->longest_nodes > n->longest_nodes)
+					n->longest_nodes = child->longest_nodes;
+			}
+		}
+
+		n->longest_bytes += (uint32_t) label;
+		n->longest_nodes++;
+	}
+
+	for (pos = target = 0, last = 0; !last;) {
+		struct node_info *child;
+
+		NextLink(graph, length, wide, &pos, &target, &last);
+		child = &info[FindNode(walk.pos, walk.nnodes, target)];
+		entries += child->entries;
+		if (child->longest_bytes > longest_bytes)
+			longest_bytes = child->longest_bytes;
+		if (child->longest_nodes > longest_nodes)
+			longest_nodes = child->longest_nodes;
+	}
+
+	/* modelled bytes and cache lines touched per host lookup */
+	if (nhosts) {
+		if (!(trace.byte_seen = calloc(length / 8 + 1, 1))
+			|| !(trace.line_seen = calloc(length / CACHE_LINE_SIZE / 8 + 1, 1)))
+			goto nomem;
+
+		for (it = 0; it < nhosts; it++) {
+			const char *suffix = hosts[it];
+
+			while (suffix) {
+				unsigned char key[MAX_KEY_LENGTH];
+				int key_length = Transcode(suffix, strlen(suffix), utf_mode, key, sizeof(key)), value = -1;
+
+				if (key_length >= 0)
+					value = TraceLookup(graph, length, wide, index_length, key, (size_t) key_length, &trace);
+
+				if (value >= 0) {
+					/* like hsts_search(): a parent domain only matches with 'include_subdomains' */
+					if (suffix == hosts[it] || (value & FLAG_INCLUDE_SUBDOMAINS))
+						matched++;
+					break;
+				}
+
+				if ((suffix = strchr(suffix, '.')))
+					suffix++;
+			}
+
+			ResetTrace(&trace);
+			if (trace.nomem)
+				goto nomem;
+		}
+	}
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"version\": %d,\n", version);
+	fprintf(fp, "  \"utf8\": %s,\n", utf_mode ? "true" : "false");
+	fprintf(fp, "  \"size\": %zu,\n", length);
+	fprintf(fp, "  \"records\": %d,\n", nrecords);
+	fprintf(fp, "  \"entries\": %llu,\n", (unsigned long long) entries);
+	fprintf(fp, "  \"bytes_per_entry\": %.2f,\n", entries ? (double) length / entries : 0.0);
+	fprintf(fp, "  \"nodes\": %zu,\n", walk.nnodes);
+	fprintf(fp, "  \"end_nodes\": %zu,\n", end_nodes);
+	fprintf(fp, "  \"label_length\": ");
+	PrintHistogram(fp, &label_length);
+	fprintf(fp, ",\n  \"offset_width\": ");
+	PrintHistogram(fp, &offsets);
+	fprintf(fp, ",\n  \"longest_path\": {\"bytes\": %u, \"nodes\": %u},\n", longest_bytes, longest_nodes);
+	fprintf(fp, "  \"fanout\": [");
+	for (it = 1; it <= max_depth && it < MAX_DEPTH; it++) {
+		fprintf(fp, "%s\n    {\"depth\": %zu, \"histogram\": ", it > 1 ? "," : "", it);
+		PrintHistogram(fp, &fanout[it]);
+		fputc('}', fp);
+	}
+	fprintf(fp, "\n  ]");
+	if (nhosts) {
+		fprintf(fp, ",\n  \"sample\": {\"hosts\": %zu, \"matched\": %zu, \"bytes_per_lookup\": %.2f, \"cache_lines_per_lookup\": %.2f}",
+			nhosts, matched, (double) trace.bytes / nhosts, (double) trace.lines / nhosts);
+	}
+	fprintf(fp, "\n}\n");
+
+	rc = 0;
+	goto out;
+
+nomem:
+	rc = -2;
+
+out:
+	for (it = 0; it < MAX_DEPTH; it++)
+		free(fanout[it].count);
+	free(offsets.count);
+	free(label_length.count);
+	free(trace.touched);
+	free(trace.line_seen);
+	free(trace.byte_seen);
+	free(info);
+	free(walk.depth);
+	free(walk.pos);
+	free(walk.visited);
+
+	return rc;
+}
@@ -30,10 +30,16 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifdef HAVE_MEMFD_CREATE
+#	include <sys/mman.h>
+#endif
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #include <libhsts.h>
 
@@ -51,10 +57,35 @@
 #  define LIBHSTS_UNUSED
 #endif
 
+/* hit counting needs thread-local storage and the __atomic builtins */
+#if GCC_VERSION_AT_LEAST(4,7) || defined(__clang__)
+#  define HSTS_WITH_HITS 1
+#endif
+
 /* prototypes */
-int LookupStringInFixedSet(const unsigned char* graph, size_t length, const char* key, size_t key_length);
+int LookupStringInFixedSetPos(const unsigned char* graph, size_t length, const char* key, size_t key_length,
+	const unsigned char** value_pos);
+int LookupStringInFixedSetAsciiPos(const unsigned char* graph, size_t length, const char* key, size_t key_length,
+	const unsigned char** value_pos);
+int LookupStringInFixedSetWidePos(const unsigned char* graph, size_t length, const char* key, size_t key_length,
+	const unsigned char** value_pos);
+int LookupStringInFixedSetAsciiWidePos(const unsigned char* graph, size_t length, const char* key, size_t key_length,
+	const unsigned char** value_pos);
 int GetUtfMode(const unsigned char *graph, size_t length);
 
+typedef struct perfect_hash_st perfect_hash_t;
+perfect_hash_t *PerfectHashBuild(const unsigned char *graph, size_t length, int with_index, int wide);
+int PerfectHashSearch(const perfect_hash_t *ph, const char *domain, size_t length, int *index, int *slot, int *is_suffix);
+int PerfectHashSlot(const perfect_hash_t *ph, const char *key, size_t length);
+size_t PerfectHashCount(const perfect_hash_t *ph);
+void PerfectHashFree(perfect_hash_t *ph);
+
+int EnumerateFixedSetRecords(const unsigned char *graph, size_t length, int with_index, int wide,
+	int (*callback)(void *, const char *, size_t, int, const unsigned char *), void *ctx);
+
+int AnalyzeFixedSet(const unsigned char *graph, size_t length, int version, size_t index_length, int wide,
+	int nrecords, const char *const *hosts, size_t nhosts, FILE *fp);
+
 #endif
 
 /**
@@ -64,31 +95,210 @@ int GetUtfMode(const unsigned char *graph, size_t length);
  * @{
  */
 
+struct _hsts_record_st {
+	const char
+		*mode,
+		*policy,
+		*pins,
+		*expect_ct_report_uri;
+	unsigned
+		expect_ct : 1;
+};
+
+/* hit counters of one thread, see hsts_set_hit_counting() */
+struct _hsts_hit_counters_st {
+	struct _hsts_hit_counters_st
+		*next;
+	const void
+		*thread; /* address of a thread-local variable of the owning thread */
+	uint64_t
+		*counts; /* indexed by the perfect hash slot of an entry */
+};
+
+struct _hsts_hits_st {
+	perfect_hash_t
+		*hash; /* dense index of the entries, may be shared with hsts->hash */
+	struct _hsts_hit_counters_st
+		*counters; /* one per thread, only ever prepended to */
+	size_t
+		nentries;
+	unsigned long
+		id; /* tells the thread-local caches of different objects apart */
+};
+
 struct _hsts_st {
 	unsigned char
+		*data; /* file data following the header */
+	void
+		*map; /* shared mapping of hsts_import_fd(), holds header and data */
+	size_t
+		map_size;
+	const unsigned char
 		*dafsa;
 	size_t
 		dafsa_size;
+	struct _hsts_record_st
+		*records; /* policy records (format version 1 and 3) */
+	perfect_hash_t
+		*hash; /* HSTS_ENGINE_HASH */
+	struct _hsts_hits_st
+		*hits; /* NULL unless hit counting is enabled */
+	int
+		(*lookup)(const unsigned char *, size_t, const char *, size_t, const unsigned char **); /* selected by utf8 and version */
 	int
+		version,
+		nrecords,
 		nsuffixes;
 	unsigned
 		utf8 : 1; /* 1: data contains UTF-8 + punycode encoded rules */
 };
 
+struct _hsts_cursor_st {
+	const hsts_t
+		*hsts;
+	struct _hsts_cursor_suffix_st {
+		const struct _hsts_record_st
+			*record;
+		int
+			flags; /* lookup result, -1: not found, -2: not looked up yet */
+	}
+		suffix[128]; /* indexed by the number of labels of the suffix */
+	int
+		nlabels; /* number of labels of the previous domain, 0 if no suffix was looked up */
+	size_t
+		length; /* length of the previous domain */
+	char
+		domain[256]; /* previous domain */
+};
+
 struct _hsts_entry_st {
+	const struct _hsts_record_st
+		*record;
 	int
 		flags;
 };
 
+#define HSTS_RECORD_FLAG_EXPECT_CT (1<<0)
+
+/* bits of the format version */
+#define HSTS_VERSION_RECORDS (1<<0)
+#define HSTS_VERSION_WIDE_OFFSETS (1<<1)
+
+/* bytes of the record index following each return value with HSTS_VERSION_RECORDS */
+#define HSTS_RECORD_INDEX_LENGTH 2
+
+/* default max. size of HSTS data, see hsts_load_fp_limit() */
+#define HSTS_DEFAULT_MAX_SIZE (20 * 1024 * 1024)
+
+/* sealed memfds need memfd_create() and the sealing fcntls (Linux 3.17+) */
+#if defined HAVE_MEMFD_CREATE && defined F_ADD_SEALS && defined MFD_ALLOW_SEALING
+#	define HSTS_WITH_MEMFD 1
+#endif
+
 #ifdef HSTS_DISTFILE
 static const char _hsts_dist_filename[] = HSTS_DISTFILE;
 #else
 static const char *_hsts_dist_filename[];
 #endif
 
-static int _hsts_search(const hsts_t *hsts, const char *domain, int *flags)
+/* looks up a single key in the DAFSA, returns the flags or -1 if not found */
+static int _hsts_lookup(const hsts_t *hsts, const char *key, size_t length, const struct _hsts_record_st **record)
+{
+	const unsigned char *pos;
+	int rc;
+
+	if ((rc = hsts->lookup(hsts->dafsa, hsts->dafsa_size, key, length, &pos)) != -1 && record) {
+		*record = NULL;
+
+		/* the record index directly follows the return value */
+		if (hsts->nrecords && pos + 2 < hsts->dafsa + hsts->dafsa_size) {
+			int index = (pos[1] << 8) | pos[2];
+
+			if (index < hsts->nrecords)
+				*record = &hsts->records[index];
+		}
+	}
+
+	return rc;
+}
+
+#ifdef HSTS_WITH_HITS
+/* the counters of the object the current thread counted last */
+static __thread struct {
+	unsigned long
+		id;
+	uint64_t
+		*counts;
+} _hsts_hits_cache;
+
+static unsigned long _hsts_hits_next_id;
+
+/* finds or adds the counters of the current thread, NULL if out of memory */
+static uint64_t *_hsts_thread_counts(struct _hsts_hits_st *hits)
+{
+	struct _hsts_hit_counters_st *c;
+	const void *thread = &_hsts_hits_cache;
+
+	for (c = __atomic_load_n(&hits->counters, __ATOMIC_ACQUIRE); c; c = c->next) {
+		if (c->thread == thread)
+			break;
+	}
+
+	if (!c) {
+		if (!(c = calloc(1, sizeof(*c) + hits->nentries * sizeof(uint64_t))))
+			return NULL;
+
+		c->thread = thread;
+		c->counts = (uint64_t *) (c + 1);
+		c->next = __atomic_load_n(&hits->counters, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&hits->counters, &c->next, c, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	}
+
+	_hsts_hits_cache.id = hits->id;
+	_hsts_hits_cache.counts = c->counts;
+
+	return c->counts;
+}
+
+/* counts a hit of the entry in slot, only the owning thread writes its counters */
+static void _hsts_count_hit(const hsts_t *hsts, int slot)
+{
+	uint64_t *counts;
+
+	if (slot < 0)
+		return;
+
+	if (_hsts_hits_cache.id == hsts->hits->id)
+		counts = _hsts_hits_cache.counts;
+	else if (!(counts = _hsts_thread_counts(hsts->hits)))
+		return;
+
+	__atomic_store_n(&counts[slot], counts[slot] + 1, __ATOMIC_RELAXED);
+}
+#else
+static void _hsts_count_hit(LIBHSTS_UNUSED const hsts_t *hsts, LIBHSTS_UNUSED int slot)
+{
+}
+#endif
+
+/* counts the dots of domain into *ndots and returns where an ASCII-only DAFSA can start to match */
+static const char *_hsts_ascii_suffix(const hsts_t *hsts, const char *domain, int *ndots)
+{
+	const char *p, *ascii_suffix = domain;
+
+	for (p = domain; *p; p++) {
+		if (*p == '.')
+			(*ndots)++;
+		else if ((*p & 0x80) && !hsts->utf8)
+			ascii_suffix = p + 1;
+	}
+
+	return ascii_suffix;
+}
+
+static int _hsts_search(const hsts_t *hsts, const char *domain, int *flags, const struct _hsts_record_st **record)
 {
-	const char *p, *suffix_label;
+	const char *suffix_label, *ascii_suffix;
 	int suffix_nlabels;
 	size_t suffix_length;
 	int must_have_include_subdomains;
@@ -97,19 +307,40 @@ static int _hsts_search(const hsts_t *hsts, const char *domain, int *flags)
 	if (*domain == '.')
 		domain++;
 
-	suffix_nlabels = 1;
+	if (hsts->hash) {
+		int rc, index, slot, is_suffix;
 
-	for (p = domain; *p; p++) {
-		if (*p == '.')
-			suffix_nlabels++;
+		if ((rc = PerfectHashSearch(hsts->hash, domain, strlen(domain), &index, &slot, &is_suffix)) == -1)
+			return -1; // didn't find domain
+
+		if (flags)
+			*flags = rc;
+
+		if (record)
+			*record = index < hsts->nrecords ? &hsts->records[index] : NULL;
+
+		if (is_suffix && !(rc & HSTS_FLAG_INCLUDE_SUBDOMAINS))
+			return -1; /* found a subdomain without 'include_subdomains' flag */
+
+		if (hsts->hits)
+			_hsts_count_hit(hsts, slot);
+
+		return 0; // domain found
 	}
 
+	suffix_nlabels = 1;
+	ascii_suffix = _hsts_ascii_suffix(hsts, domain, &suffix_nlabels);
+
 	suffix_label = domain;
-	suffix_length = (size_t) (p - suffix_label);
+	suffix_length = strlen(suffix_label);
 	must_have_include_subdomains = 0;
 
 	for (;;) {
-		int rc = LookupStringInFixedSet(hsts->dafsa, hsts->dafsa_size, suffix_label, suffix_length);
+		int rc = -1;
+
+		if (suffix_label >= ascii_suffix)
+			rc = _hsts_lookup(hsts, suffix_label, suffix_length, record);
+
 		if (rc != -1) {
 			if (flags)
 				*flags = rc;
@@ -117,6 +348,9 @@ static int _hsts_search(const hsts_t *hsts, const char *domain, int *flags)
 			if (must_have_include_subdomains && !(rc & HSTS_FLAG_INCLUDE_SUBDOMAINS))
 				return -1; /* found a subdomain without 'include_subdomains' flag */
 
+			if (hsts->hits)
+				_hsts_count_hit(hsts, PerfectHashSlot(hsts->hits->hash, suffix_label, suffix_length));
+
 			return 0; // domain found
 		}
 
@@ -132,6 +366,22 @@ static int _hsts_search(const hsts_t *hsts, const char *domain, int *flags)
 	return -1; // didn't find domain
 }
 
+static hsts_status_t _hsts_new_entry(int flags, const struct _hsts_record_st *record, hsts_entry_t **entry)
+{
+	if (entry) {
+		hsts_entry_t *e = calloc(1, sizeof(hsts_entry_t));
+
+		if (!e)
+			return HSTS_ERR_NO_MEM;
+
+		e->flags = flags;
+		e->record = record;
+		*entry = e;
+	}
+
+	return HSTS_SUCCESS;
+}
+
 /**
  * \param[in] hsts HSTS data object
  * \param[in] domain Domain input string
@@ -157,175 +407,1106 @@ static int _hsts_search(const hsts_t *hsts, const char *domain, int *flags)
  */
 int hsts_search(const hsts_t *hsts, const char *domain, LIBHSTS_UNUSED int flags, hsts_entry_t **entry)
 {
+	const struct _hsts_record_st *record;
 	int eflags;
 
 	if (!hsts || !domain)
 		return HSTS_ERR_INVALID_ARG;
 
-	if (_hsts_search(hsts, domain, &eflags) == 0) {
-		if (entry) {
-			hsts_entry_t *e = calloc(1, sizeof(hsts_entry_t));
-
-			if (!e)
-				return HSTS_ERR_NO_MEM;
-
-			e->flags = eflags;
-			*entry = e;
-		}
-
-		return HSTS_SUCCESS;
-	}
+	if (_hsts_search(hsts, domain, &eflags, &record) == 0)
+		return _hsts_new_entry(eflags, record, entry);
 
 	return HSTS_ERR_NOT_FOUND;
 }
 
 /**
- * \param[in] entry The domain entry to check
- * \return 1 if \p entry has the 'include_subdomain' attribute, 0 if not.
+ * \param[in] hsts HSTS data object
+ * \param[out] cursor Returned cursor object
  *
- * This function checks if an \p entry returned from hsts_search() has the 'include_subdomain'
- * attribute or not.
+ * This function creates a cursor for looking up many domains in \p hsts with hsts_cursor_search().
+ *
+ * The cursor keeps a reference to \p hsts, so \p hsts must not be freed before the cursor.
+ * A cursor must not be used by several threads at the same time.
+ * When done you have to free the cursor by calling hsts_cursor_free().
+ *
+ * \return %HSTS_SUCCESS on success.
+ *   %HSTS_ERR_INVALID_ARG is returned if \p hsts or \p cursor was %NULL.
+ *   %HSTS_ERR_NO_MEM is returned if a memory allocation failed.
+ *
+ * Since: 0.2.0
  */
-int hsts_has_include_subdomains(const hsts_entry_t *entry)
+hsts_status_t hsts_cursor_new(const hsts_t *hsts, hsts_cursor_t **cursor)
 {
-	if (!entry)
-		return 0;
+	hsts_cursor_t *c;
+	unsigned it;
 
-	return !!(entry->flags & HSTS_FLAG_INCLUDE_SUBDOMAINS);
+	if (!hsts || !cursor)
+		return HSTS_ERR_INVALID_ARG;
+
+	if (!(c = calloc(1, sizeof(hsts_cursor_t))))
+		return HSTS_ERR_NO_MEM;
+
+	c->hsts = hsts;
+	for (it = 0; it < sizeof(c->suffix) / sizeof(c->suffix[0]); it++)
+		c->suffix[it].flags = -2;
+
+	*cursor = c;
+	return HSTS_SUCCESS;
 }
 
 /**
- * \param[in] fname Name of a HSTS data file
- * \param[out] hsts Returned HSTS data
- *
- * This function loads the HSTS data from a file named \p fname.
- * On success \p hsts will be initialized, else it will be left untouched.
- *
- * The returned \p hsts object can be used with functions like hsts_get_entry().
- * When done you have to free the hsts object by calling hsts_free().
+ * \param[in] cursor Cursor to be freed
  *
- * @return HSTS_SUCCESS on success, else another hsts_status_t value
+ * This function frees a cursor created by hsts_cursor_new().
  *
- * Since: 0.0.1
+ * Since: 0.2.0
  */
-hsts_status_t hsts_load_file(const char *fname, hsts_t **hsts)
+void hsts_cursor_free(hsts_cursor_t *cursor)
 {
-	FILE *fp;
-	hsts_status_t rc;
+	free(cursor);
+}
 
-	if (!fname)
-		return HSTS_ERR_INVALID_ARG;
+/* remembers domain (without leading dot) as the previous domain, without any lookup results */
+static void _hsts_cursor_reset(hsts_cursor_t *cursor, const char *domain, size_t length)
+{
+	int it;
 
-	rc = hsts_load_fp(fp = fopen(fname, "rb"), hsts);
+	for (it = 1; it <= cursor->nlabels; it++)
+		cursor->suffix[it].flags = -2;
 
-	if (fp)
-		fclose(fp);
+	/* no suffix has been looked up yet, so there is nothing to forget next time */
+	cursor->nlabels = 0;
 
-	return rc;
+	if (length < sizeof(cursor->domain)) {
+		memcpy(cursor->domain, domain, length + 1);
+		cursor->length = length;
+	} else
+		cursor->length = 0;
 }
 
 /**
- * @param[in] fp FILE pointer of a HSTS data file
- * @param[out] hsts Returned HSTS data
+ * \param[in] cursor Cursor object
+ * \param[in] domain Domain input string
+ * \param[in] flags Flags, currently unused
+ * \param[out] entry Return value on success, else untouched
  *
- * This function loads the HSTS data from a file named \p fname.
- * On success \p hsts will be initialized, else it will be left untouched.
+ * This function returns the same results as hsts_search(), but is faster if consecutive domains
+ * share parent domains, e.g. when they are sorted in reversed-domain order
+ * (com.example, com.example.a, com.example.b, ...).
  *
- * The returned \p hsts object can be used with functions like hsts_get_entry().
- * When done you have to free the hsts object by calling hsts_free().
+ * The DAFSA is keyed from the start of the domain, so there is no traversal state to resume
+ * between 'a.example.com' and 'b.example.com'. Instead, the cursor remembers the lookup results
+ * for the label suffixes of the previous domain ('example.com', 'com') and only looks up the suffixes
+ * that are not shared with it. If nothing is shared, this is a plain hsts_search().
  *
- * @return HSTS_SUCCESS on success, else another hsts_status_t value
+ * With %HSTS_ENGINE_HASH, this function is the same as hsts_search().
  *
- * Since: 0.0.1
+ * \return %HSTS_SUCCESS if \p domain is has been found, if not %HSTS_ERR_NOT_FOUND.
+ *   HSTS_ERR_INVALID_ARG is returned if either \p cursor or \p domain was %NULL.
+ *   HSTS_ERR_NO_MEM is returned if a memory allocation failed.
+ *
+ * Since: 0.2.0
  */
-hsts_status_t hsts_load_fp(FILE *fp, hsts_t **hsts)
+hsts_status_t hsts_cursor_search(hsts_cursor_t *cursor, const char *domain, int flags, hsts_entry_t **entry)
 {
-	hsts_t *_hsts;
-	char buf[16];
-	int version;
-	void *m;
-	size_t size, n, len = 0;
+	const hsts_t *hsts;
+	const char *a, *b, *suffix_label, *ascii_suffix, *orig_domain = domain;
+	size_t length;
+	int nshared, nlabels, it, rc;
 
-	if (!fp)
+	if (!cursor || !domain)
 		return HSTS_ERR_INVALID_ARG;
 
-	if ((n = fread(buf, 1, sizeof(buf), fp)) < sizeof(buf))
-		return ferror(fp) ? HSTS_ERR_INPUT_FAILURE : HSTS_ERR_INPUT_TOO_SHORT;
+	hsts = cursor->hsts;
 
-	buf[sizeof(buf) - 1] = 0;
+	if (hsts->hash)
+		return hsts_search(hsts, domain, flags, entry);
 
-	if (strncmp(buf, ".DAFSA@HSTS_", 12))
-		return HSTS_ERR_INPUT_FORMAT;
+	/* hsts_search() strips the leading dot itself, so fallbacks get orig_domain */
+	if (*domain == '.')
+		domain++;
 
-	if ((version = atoi(buf + 12)) != 0)
-		return HSTS_ERR_INPUT_VERSION;
+	length = strlen(domain);
 
-	if (!(_hsts = calloc(1, sizeof(hsts_t))))
-		return HSTS_ERR_NO_MEM;
+	/* count the trailing labels shared with the previous domain */
+	nshared = 0;
+	for (a = domain + length, b = cursor->domain + cursor->length; a > domain && b > cursor->domain && a[-1] == b[-1]; a--, b--) {
+		if (a[-1] == '.')
+			nshared++;
+	}
+	if (a < domain + length && (a == domain || a[-1] == '.') && (b == cursor->domain || b[-1] == '.'))
+		nshared++;
 
-	if (!(_hsts->dafsa = malloc(size = 384 * 1024))) { /* 13.3.2018: the current size is ~340k, avoid reallocs */
-		hsts_free(_hsts);
-		return HSTS_ERR_NO_MEM;
+	/* nothing to reuse: a plain search, the cursor only remembers the domain afterwards */
+	if (!nshared || length >= sizeof(cursor->domain)) {
+		rc = hsts_search(hsts, orig_domain, flags, entry);
+		_hsts_cursor_reset(cursor, domain, length);
+		return rc;
 	}
 
-	while ((n = fread(_hsts->dafsa + len, 1, size - len, fp)) > 0) {
-		len += n;
-		if (len >= size) {
-			if (size >= 20 * 1024 * 1024) {
-				/* Apply a random max. file size to avoid overflows / DOS attacks */
-				hsts_free(_hsts);
-				return HSTS_ERR_INPUT_TOO_LONG;
-			}
-			if (!(m = realloc(_hsts->dafsa, size *= 2))) {
-				hsts_free(_hsts);
-				return HSTS_ERR_NO_MEM;
-			}
-			_hsts->dafsa = m;
+	nlabels = 1;
+	ascii_suffix = _hsts_ascii_suffix(hsts, domain, &nlabels);
+
+	if (nlabels >= (int) (sizeof(cursor->suffix) / sizeof(cursor->suffix[0]))) {
+		_hsts_cursor_reset(cursor, domain, length);
+		return hsts_search(hsts, orig_domain, flags, entry);
+	}
+
+	/* forget the results for all other suffixes of the previous domain */
+	for (it = nshared + 1; it <= cursor->nlabels; it++)
+		cursor->suffix[it].flags = -2;
+
+	memcpy(cursor->domain, domain, length + 1);
+	cursor->length = length;
+	cursor->nlabels = nlabels;
+
+	for (suffix_label = domain, it = nlabels; it > 0; it--) {
+		struct _hsts_cursor_suffix_st *suffix = &cursor->suffix[it];
+
+		if (suffix->flags == -2) {
+			suffix->flags = -1;
+			if (suffix_label >= ascii_suffix)
+				suffix->flags = _hsts_lookup(hsts, suffix_label, length - (size_t) (suffix_label - domain), &suffix->record);
+		}
+
+		if (suffix->flags != -1) {
+			if (it < nlabels && !(suffix->flags & HSTS_FLAG_INCLUDE_SUBDOMAINS))
+				return HSTS_ERR_NOT_FOUND; /* found a subdomain without 'include_subdomains' flag */
+
+			if (hsts->hits)
+				_hsts_count_hit(hsts, PerfectHashSlot(hsts->hits->hash, suffix_label, length - (size_t) (suffix_label - domain)));
+
+			return _hsts_new_entry(suffix->flags, suffix->record, entry);
 		}
+
+		if ((suffix_label = strchr(suffix_label, '.')))
+			suffix_label++;
 	}
 
-	/* release unused memory */
-	if ((m = realloc(_hsts->dafsa, len)))
-		_hsts->dafsa = m;
-	else if (!len)
-		_hsts->dafsa = NULL; /* realloc() just free'd hsts->dafsa */
-	/* else we go on with the unshrunk data memory */
+	return HSTS_ERR_NOT_FOUND;
+}
+
+/**
+ * \param[in] entry The domain entry to check
+ * \return 1 if \p entry has the 'include_subdomain' attribute, 0 if not.
+ *
+ * This function checks if an \p entry returned from hsts_search() has the 'include_subdomain'
+ * attribute or not.
+ */
+int hsts_has_include_subdomains(const hsts_entry_t *entry)
+{
+	if (!entry)
+		return 0;
 
-	_hsts->dafsa_size = len;
-	_hsts->utf8 = !!GetUtfMode(_hsts->dafsa, len);
+	return !!(entry->flags & HSTS_FLAG_INCLUDE_SUBDOMAINS);
+}
 
-	if (hsts)
-		*hsts = _hsts;
-	else
-		hsts_free(_hsts);
+/**
+ * \param[in] entry The domain entry to check
+ * \return The 'mode' attribute of \p entry (e.g. "force-https") or %NULL if not set.
+ *
+ * This function returns the 'mode' attribute of an \p entry returned from hsts_search().
+ *
+ * Policy records are only available if the HSTS data has been generated with
+ * `hsts-make-dafsa --records`, else %NULL is returned.
+ * The returned string is valid until the HSTS data object is freed.
+ *
+ * Since: 0.2.0
+ */
+const char *hsts_get_mode(const hsts_entry_t *entry)
+{
+	if (!entry || !entry->record)
+		return NULL;
 
-	return HSTS_SUCCESS;
+	return entry->record->mode;
 }
 
 /**
- * \param[in] entry HSTS entry to be freed
+ * \param[in] entry The domain entry to check
+ * \return The 'policy' attribute of \p entry (e.g. "bulk-hsts") or %NULL if not set.
  *
- * This function frees the the HSTS entry that has been retrieved via hsts_search().
+ * This function returns the policy group of an \p entry returned from hsts_search().
  *
- * Since: 0.0.1
+ * See hsts_get_mode() for availability and lifetime of the returned string.
+ *
+ * Since: 0.2.0
  */
-void hsts_free_entry(hsts_entry_t *entry)
+const char *hsts_get_policy(const hsts_entry_t *entry)
 {
-	free(entry);
+	if (!entry || !entry->record)
+		return NULL;
+
+	return entry->record->policy;
 }
 
 /**
- * \param[in] hsts HSTS data pointer to be freed
+ * \param[in] entry The domain entry to check
+ * \return The name of the pinset of \p entry (e.g. "google") or %NULL if not set.
  *
- * This function frees the the HSTS data object that has been retrieved via
- * hsts_load_fp() or hsts_load_file().
+ * This function returns the pinset name of an \p entry returned from hsts_search().
  *
- * Since: 0.0.1
+ * See hsts_get_mode() for availability and lifetime of the returned string.
+ *
+ * Since: 0.2.0
  */
-void hsts_free(hsts_t *hsts)
+const char *hsts_get_pinset(const hsts_entry_t *entry)
 {
-	if (hsts) {
-		free(hsts->dafsa);
+	if (!entry || !entry->record)
+		return NULL;
+
+	return entry->record->pins;
+}
+
+/**
+ * \param[in] entry The domain entry to check
+ * \return 1 if \p entry has the 'expect_ct' attribute, 0 if not.
+ *
+ * This function checks if an \p entry returned from hsts_search() has the 'expect_ct'
+ * attribute or not.
+ *
+ * See hsts_get_mode() for availability.
+ *
+ * Since: 0.2.0
+ */
+int hsts_has_expect_ct(const hsts_entry_t *entry)
+{
+	if (!entry || !entry->record)
+		return 0;
+
+	return entry->record->expect_ct;
+}
+
+/**
+ * \param[in] entry The domain entry to check
+ * \return The 'expect_ct_report_uri' attribute of \p entry or %NULL if not set.
+ *
+ * This function returns the Expect-CT report URI of an \p entry returned from hsts_search().
+ *
+ * See hsts_get_mode() for availability and lifetime of the returned string.
+ *
+ * Since: 0.2.0
+ */
+const char *hsts_get_expect_ct_report_uri(const hsts_entry_t *entry)
+{
+	if (!entry || !entry->record)
+		return NULL;
+
+	return entry->record->expect_ct_report_uri;
+}
+
+static int _hsts_get_string(const unsigned char **p, const unsigned char *end, const char **s)
+{
+	const unsigned char *nul;
+
+	if (*p >= end || !(nul = memchr(*p, 0, (size_t) (end - *p))))
+		return -1;
+
+	*s = **p ? (const char *) *p : NULL; /* empty strings are returned as NULL */
+	*p = nul + 1;
+
+	return 0;
+}
+
+/* parse the policy record table that precedes the DAFSA in format version 1 and 3 */
+static hsts_status_t _hsts_parse_records(hsts_t *hsts, size_t len)
+{
+	const unsigned char *p = hsts->data, *end;
+	size_t size;
+	int it;
+
+	if (len < 6)
+		return HSTS_ERR_INPUT_TOO_SHORT;
+
+	size = ((size_t) p[0] << 24) | ((size_t) p[1] << 16) | ((size_t) p[2] << 8) | p[3];
+	if (size < 2 || size > len - 4)
+		return HSTS_ERR_INPUT_FORMAT;
+
+	end = p + 4 + size;
+	hsts->nrecords = (p[4] << 8) | p[5];
+	p += 6;
+
+	if (hsts->nrecords && !(hsts->records = calloc(hsts->nrecords, sizeof(struct _hsts_record_st))))
+		return HSTS_ERR_NO_MEM;
+
+	for (it = 0; it < hsts->nrecords; it++) {
+		struct _hsts_record_st *record = &hsts->records[it];
+
+		if (p >= end)
+			return HSTS_ERR_INPUT_FORMAT;
+
+		record->expect_ct = !!(*p++ & HSTS_RECORD_FLAG_EXPECT_CT);
+
+		if (_hsts_get_string(&p, end, &record->mode)
+			|| _hsts_get_string(&p, end, &record->policy)
+			|| _hsts_get_string(&p, end, &record->pins)
+			|| _hsts_get_string(&p, end, &record->expect_ct_report_uri))
+		{
+			return HSTS_ERR_INPUT_FORMAT;
+		}
+	}
+
+	hsts->dafsa = end;
+	hsts->dafsa_size = len - 4 - size;
+
+	return HSTS_SUCCESS;
+}
+
+/* checks the 16 byte file header, returns the format version or a hsts_status_t error */
+static int _hsts_parse_header(const void *header)
+{
+	char buf[16];
+	int version;
+
+	memcpy(buf, header, sizeof(buf));
+	buf[sizeof(buf) - 1] = 0;
+
+	if (strncmp(buf, ".DAFSA@HSTS_", 12))
+		return HSTS_ERR_INPUT_FORMAT;
+
+	if ((version = atoi(buf + 12)) & ~(HSTS_VERSION_RECORDS | HSTS_VERSION_WIDE_OFFSETS))
+		return HSTS_ERR_INPUT_VERSION;
+
+	return version;
+}
+
+/* sets up the DAFSA and the lookup function for the len bytes of hsts->data */
+static hsts_status_t _hsts_init(hsts_t *hsts, int version, size_t len)
+{
+	if (version & HSTS_VERSION_RECORDS) {
+		hsts_status_t rc;
+
+		if ((rc = _hsts_parse_records(hsts, len)) != HSTS_SUCCESS)
+			return rc;
+	} else {
+		hsts->dafsa = hsts->data;
+		hsts->dafsa_size = len;
+	}
+
+	hsts->version = version;
+	hsts->utf8 = !!GetUtfMode(hsts->dafsa, hsts->dafsa_size);
+	if (version & HSTS_VERSION_WIDE_OFFSETS)
+		hsts->lookup = hsts->utf8 ? LookupStringInFixedSetWidePos : LookupStringInFixedSetAsciiWidePos;
+	else
+		hsts->lookup = hsts->utf8 ? LookupStringInFixedSetPos : LookupStringInFixedSetAsciiPos;
+
+	return HSTS_SUCCESS;
+}
+
+static perfect_hash_t *_hsts_build_hash(const hsts_t *hsts)
+{
+	if (!hsts->dafsa_size)
+		return NULL;
+
+	return PerfectHashBuild(hsts->dafsa, hsts->dafsa_size,
+		hsts->version & HSTS_VERSION_RECORDS, hsts->version & HSTS_VERSION_WIDE_OFFSETS);
+}
+
+/**
+ * \param[in] hsts HSTS data object
+ * \param[in] engine Lookup engine to use
+ *
+ * This function selects the lookup engine used by hsts_search() and is meant to be called
+ * directly after loading the HSTS data.
+ *
+ * %HSTS_ENGINE_DAFSA (default) walks the DAFSA byte by byte.
+ *
+ * %HSTS_ENGINE_HASH builds a minimal perfect hash table over all entries of the DAFSA.
+ * This takes extra time and memory (~10 bytes per entry), but a lookup costs just one
+ * probe per label suffix of the domain. Non-members are rejected by a 32-bit fingerprint,
+ * so a non-member is found by mistake with a probability of 2^-32 per probe.
+ *
+ * \return %HSTS_SUCCESS on success.
+ *   %HSTS_ERR_INVALID_ARG is returned if \p hsts was %NULL or \p engine is unknown.
+ *   %HSTS_ERR_INPUT_FORMAT is returned if the DAFSA could not be enumerated.
+ *   %HSTS_ERR_NO_MEM is returned if a memory allocation failed.
+ *
+ * Since: 0.2.0
+ */
+hsts_status_t hsts_set_engine(hsts_t *hsts, hsts_engine_t engine)
+{
+	if (!hsts)
+		return HSTS_ERR_INVALID_ARG;
+
+	switch (engine) {
+	case HSTS_ENGINE_DAFSA:
+		if (!hsts->hits || hsts->hits->hash != hsts->hash)
+			PerfectHashFree(hsts->hash);
+		hsts->hash = NULL;
+		return HSTS_SUCCESS;
+
+	case HSTS_ENGINE_HASH:
+		if (!hsts->hash) {
+			if (hsts->hits)
+				hsts->hash = hsts->hits->hash; /* already built for hit counting */
+			else if (!(hsts->hash = _hsts_build_hash(hsts)))
+				return HSTS_ERR_INPUT_FORMAT; /* or out of memory */
+		}
+		return HSTS_SUCCESS;
+	}
+
+	return HSTS_ERR_INVALID_ARG;
+}
+
+/**
+ * \param[in] hsts HSTS data object
+ * \param[in] hosts Sample of host names to model the lookup cost, may be %NULL
+ * \param[in] nhosts Number of host names in \p hosts
+ * \param[in] fp Where to write the report
+ *
+ * This function walks the DAFSA of \p hsts and writes a JSON report about its structure to \p fp:
+ * number of entries and nodes, bytes per entry, a histogram of label lengths, the mix of
+ * 1/2/3 (or 5) byte offsets, the longest path and a histogram of the fan-out for each depth.
+ *
+ * If \p hosts is given, the byte accesses of hsts_search() with %HSTS_ENGINE_DAFSA are replayed
+ * for each host and the average number of distinct bytes and 64 byte cache lines touched per
+ * lookup is reported, together with the number of hosts that hsts_search() would match.
+ *
+ * \return %HSTS_SUCCESS on success.
+ *   %HSTS_ERR_INVALID_ARG is returned if \p hsts or \p fp was %NULL.
+ *   %HSTS_ERR_INPUT_FORMAT is returned if the DAFSA is malformed.
+ *   %HSTS_ERR_NO_MEM is returned if a memory allocation failed.
+ *
+ * Since: 0.2.0
+ */
+hsts_status_t hsts_analyze(const hsts_t *hsts, const char *const *hosts, size_t nhosts, FILE *fp)
+{
+	if (!hsts || !fp || (!hosts && nhosts))
+		return HSTS_ERR_INVALID_ARG;
+
+	if (!hsts->dafsa_size)
+		return HSTS_ERR_INPUT_FORMAT;
+
+	switch (AnalyzeFixedSet(hsts->dafsa, hsts->dafsa_size, hsts->version,
+		hsts->version & HSTS_VERSION_RECORDS ? HSTS_RECORD_INDEX_LENGTH : 0,
+		!!(hsts->version & HSTS_VERSION_WIDE_OFFSETS), hsts->nrecords, hosts, nhosts, fp)) {
+	case 0:
+		return HSTS_SUCCESS;
+	case -2:
+		return HSTS_ERR_NO_MEM;
+	default:
+		return HSTS_ERR_INPUT_FORMAT;
+	}
+}
+
+static void _hsts_free_hits(hsts_t *hsts)
+{
+	struct _hsts_hit_counters_st *c, *next;
+
+	if (!hsts->hits)
+		return;
+
+	if (hsts->hits->hash != hsts->hash)
+		PerfectHashFree(hsts->hits->hash);
+
+	for (c = hsts->hits->counters; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+
+	free(hsts->hits);
+	hsts->hits = NULL;
+}
+
+/**
+ * \param[in] hsts HSTS data object
+ * \param[in] enable 1 to enable hit counting, 0 to disable it
+ *
+ * This function enables or disables counting how often each entry of \p hsts decides a successful
+ * hsts_search() or hsts_cursor_search(). The counts are read with hsts_top_entries().
+ * Like hsts_set_engine(), it is meant to be called before \p hsts is used for lookups and
+ * must not be called while other threads use \p hsts. Disabling drops all counts.
+ *
+ * Enabling builds the minimal perfect hash table of %HSTS_ENGINE_HASH (shared with that engine),
+ * its slots are the dense indexes of the entries. Each thread that counts a hit gets its own array
+ * of 8 bytes per entry, so threads don't contend for cache lines. The counts of terminated threads
+ * are kept.
+ *
+ * Disabled, the cost per lookup is one test of a pointer. Enabled, each hit costs a store to the
+ * thread's array (a few ns with %HSTS_ENGINE_HASH). With %HSTS_ENGINE_DAFSA, each hit also probes
+ * the hash table for the matched entry, ~90ns with a 20k entry list (see bench-hsts with BENCH_HITS=1).
+ *
+ * \return %HSTS_SUCCESS on success.
+ *   %HSTS_ERR_INVALID_ARG is returned if \p hsts was %NULL.
+ *   %HSTS_ERR_INPUT_FORMAT is returned if the DAFSA could not be enumerated.
+ *   %HSTS_ERR_NO_MEM is returned if a memory allocation failed.
+ *   %HSTS_ERR_NOT_SUPPORTED is returned if the compiler lacks thread-local storage or atomics.
+ *
+ * Since: 0.2.0
+ */
+hsts_status_t hsts_set_hit_counting(hsts_t *hsts, int enable)
+{
+	if (!hsts)
+		return HSTS_ERR_INVALID_ARG;
+
+	if (!enable) {
+		_hsts_free_hits(hsts);
+		return HSTS_SUCCESS;
+	}
+
+#ifdef HSTS_WITH_HITS
+	if (hsts->hits)
+		return HSTS_SUCCESS;
+
+	if (!(hsts->hits = calloc(1, sizeof(struct _hsts_hits_st))))
+		return HSTS_ERR_NO_MEM;
+
+	if (!(hsts->hits->hash = hsts->hash ? hsts->hash : _hsts_build_hash(hsts))) {
+		free(hsts->hits);
+		hsts->hits = NULL;
+		return HSTS_ERR_INPUT_FORMAT; /* or out of memory */
+	}
+
+	hsts->hits->nentries = PerfectHashCount(hsts->hits->hash);
+	hsts->hits->id = __atomic_add_fetch(&_hsts_hits_next_id, 1, __ATOMIC_RELAXED);
+
+	return HSTS_SUCCESS;
+#else
+	return HSTS_ERR_NOT_SUPPORTED;
+#endif
+}
+
+#ifdef HSTS_WITH_HITS
+struct _hsts_top_ctx {
+	const perfect_hash_t
+		*hash;
+	const uint64_t
+		*counts; /* merged counts of all threads */
+	hsts_hit_t
+		*heap; /* min-heap of the top entries, domains are malloc'ed */
+	size_t
+		n,
+		nheap;
+	int
+		no_mem;
+};
+
+static int _hsts_hit_less(const hsts_hit_t *a, const hsts_hit_t *b)
+{
+	return a->hits < b->hits || (a->hits == b->hits && strcmp(a->domain, b->domain) > 0);
+}
+
+/* most hits first */
+static int _hsts_hit_cmp(const void *p1, const void *p2)
+{
+	return _hsts_hit_less(p1, p2) - _hsts_hit_less(p2, p1);
+}
+
+static void _hsts_sift_down(hsts_hit_t *heap, size_t n, size_t it)
+{
+	for (;;) {
+		size_t min = it, child = it * 2 + 1;
+		hsts_hit_t tmp;
+
+		if (child < n && _hsts_hit_less(&heap[child], &heap[min]))
+			min = child;
+		if (child + 1 < n && _hsts_hit_less(&heap[child + 1], &heap[min]))
+			min = child + 1;
+		if (min == it)
+			return;
+
+		tmp = heap[it];
+		heap[it] = heap[min];
+		heap[min] = tmp;
+		it = min;
+	}
+}
+
+static int _hsts_collect_top(void *_ctx, const char *key, size_t key_length, LIBHSTS_UNUSED int value,
+	LIBHSTS_UNUSED const unsigned char *value_pos)
+{
+	struct _hsts_top_ctx *ctx = _ctx;
+	hsts_hit_t hit;
+	char *domain;
+	int slot;
+
+	if ((slot = PerfectHashSlot(ctx->hash, key, key_length)) < 0 || !(hit.hits = ctx->counts[slot]))
+		return 0;
+
+	if (ctx->nheap == ctx->n) {
+		/* compare with the smallest of the top entries before copying the key */
+		if (hit.hits < ctx->heap[0].hits)
+			return 0;
+	}
+
+	if (!(domain = malloc(key_length + 1))) {
+		ctx->no_mem = 1;
+		return -1;
+	}
+
+	memcpy(domain, key, key_length);
+	domain[key_length] = 0;
+	hit.domain = domain;
+
+	if (ctx->nheap < ctx->n) {
+		size_t it = ctx->nheap++;
+
+		/* sift up */
+		while (it && _hsts_hit_less(&hit, &ctx->heap[(it - 1) / 2])) {
+			ctx->heap[it] = ctx->heap[(it - 1) / 2];
+			it = (it - 1) / 2;
+		}
+		ctx->heap[it] = hit;
+	} else if (_hsts_hit_less(&ctx->heap[0], &hit)) {
+		free((char *) ctx->heap[0].domain);
+		ctx->heap[0] = hit;
+		_hsts_sift_down(ctx->heap, ctx->nheap, 0);
+	} else
+		free(domain);
+
+	return 0;
+}
+#endif
+
+/**
+ * \param[in] hsts HSTS data object with hit counting enabled
+ * \param[in] n Max. number of entries to return
+ * \param[out] top Returned array of entries, most hits first
+ * \param[out] ntop Number of entries in \p top
+ *
+ * This function merges the hit counters of all threads and returns the (up to) \p n entries with
+ * the most hits, see hsts_set_hit_counting(). Entries without hits are not returned, entries with
+ * the same number of hits are sorted by name.
+ *
+ * The counters are read while other threads may still count, so a concurrent hit may or may not
+ * be included. Merging walks all entries of \p hsts and takes about as long as hsts_set_engine()
+ * with %HSTS_ENGINE_HASH.
+ *
+ * When done you have to free \p top by calling hsts_free_top_entries().
+ *
+ * \return %HSTS_SUCCESS on success.
+ *   %HSTS_ERR_INVALID_ARG is returned if \p hsts, \p top or \p ntop was %NULL or hit counting
+ *   is not enabled.
+ *   %HSTS_ERR_INPUT_FORMAT is returned if the DAFSA could not be enumerated.
+ *   %HSTS_ERR_NO_MEM is returned if a memory allocation failed.
+ *
+ * Since: 0.2.0
+ */
+hsts_status_t hsts_top_entries(const hsts_t *hsts, size_t n, hsts_hit_t **top, size_t *ntop)
+{
+#ifdef HSTS_WITH_HITS
+	struct _hsts_top_ctx ctx;
+	struct _hsts_hit_counters_st *c;
+	uint64_t *counts;
+	hsts_hit_t *result;
+	size_t it, size;
+	char *p;
+	int rc;
+
+	if (!hsts || !hsts->hits || !top || !ntop)
+		return HSTS_ERR_INVALID_ARG;
+
+	if (!(counts = calloc(hsts->hits->nentries, sizeof(uint64_t))))
+		return HSTS_ERR_NO_MEM;
+
+	for (c = __atomic_load_n(&hsts->hits->counters, __ATOMIC_ACQUIRE); c; c = c->next) {
+		for (it = 0; it < hsts->hits->nentries; it++)
+			counts[it] += __atomic_load_n(&c->counts[it], __ATOMIC_RELAXED);
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.hash = hsts->hits->hash;
+	ctx.counts = counts;
+	ctx.n = n < hsts->hits->nentries ? n : hsts->hits->nentries;
+
+	if (ctx.n && !(ctx.heap = malloc(ctx.n * sizeof(hsts_hit_t)))) {
+		free(counts);
+		return HSTS_ERR_NO_MEM;
+	}
+
+	rc = ctx.n ? EnumerateFixedSetRecords(hsts->dafsa, hsts->dafsa_size, hsts->version & HSTS_VERSION_RECORDS,
+		hsts->version & HSTS_VERSION_WIDE_OFFSETS, _hsts_collect_top, &ctx) : 0;
+	free(counts);
+
+	/* copy the entries into a single allocation */
+	for (size = ctx.nheap * sizeof(hsts_hit_t), it = 0; it < ctx.nheap; it++)
+		size += strlen(ctx.heap[it].domain) + 1;
+
+	result = NULL;
+	if (rc == 0 && (result = malloc(size ? size : 1))) {
+		if (ctx.nheap)
+			qsort(ctx.heap, ctx.nheap, sizeof(hsts_hit_t), _hsts_hit_cmp);
+
+		for (p = (char *) (result + ctx.nheap), it = 0; it < ctx.nheap; it++) {
+			result[it].hits = ctx.heap[it].hits;
+			result[it].domain = strcpy(p, ctx.heap[it].domain);
+			p += strlen(p) + 1;
+		}
+
+		*top = result;
+		*ntop = ctx.nheap;
+	}
+
+	for (it = 0; it < ctx.nheap; it++)
+		free((char *) ctx.heap[it].domain);
+	free(ctx.heap);
+
+	if (ctx.no_mem || (rc == 0 && !result))
+		return HSTS_ERR_NO_MEM;
+
+	return rc ? HSTS_ERR_INPUT_FORMAT : HSTS_SUCCESS;
+#else
+	(void) hsts; (void) n; (void) top; (void) ntop;
+	return HSTS_ERR_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * \param[in] top Entries to be freed
+ *
+ * This function frees the entries returned by hsts_top_entries().
+ *
+ * Since: 0.2.0
+ */
+void hsts_free_top_entries(hsts_hit_t *top)
+{
+	free(top);
+}
+
+/**
+ * \param[in] fname Name of a HSTS data file
+ * \param[out] hsts Returned HSTS data
+ *
+ * This function loads the HSTS data from a file named \p fname.
+ * On success \p hsts will be initialized, else it will be left untouched.
+ *
+ * The returned \p hsts object can be used with functions like hsts_get_entry().
+ * When done you have to free the hsts object by calling hsts_free().
+ *
+ * Files larger than 20MB are rejected, see hsts_load_file_limit() for larger lists.
+ *
+ * @return HSTS_SUCCESS on success, else another hsts_status_t value
+ *
+ * Since: 0.0.1
+ */
+hsts_status_t hsts_load_file(const char *fname, hsts_t **hsts)
+{
+	return hsts_load_file_limit(fname, 0, hsts);
+}
+
+/**
+ * \param[in] fname Name of a HSTS data file
+ * \param[in] max_size Max. size of the HSTS data in bytes, 0 for the default of 20MB
+ * \param[out] hsts Returned HSTS data
+ *
+ * Same as hsts_load_file(), but HSTS data of up to \p max_size bytes is accepted.
+ *
+ * @return HSTS_SUCCESS on success, else another hsts_status_t value.
+ *   %HSTS_ERR_INPUT_TOO_LONG is returned if the file exceeds \p max_size.
+ *
+ * Since: 0.2.0
+ */
+hsts_status_t hsts_load_file_limit(const char *fname, size_t max_size, hsts_t **hsts)
+{
+	FILE *fp;
+	hsts_status_t rc;
+
+	if (!fname)
+		return HSTS_ERR_INVALID_ARG;
+
+	rc = hsts_load_fp_limit(fp = fopen(fname, "rb"), max_size, hsts);
+
+	if (fp)
+		fclose(fp);
+
+	return rc;
+}
+
+/**
+ * @param[in] fp FILE pointer of a HSTS data file
+ * @param[out] hsts Returned HSTS data
+ *
+ * This function loads the HSTS data from a file named \p fname.
+ * On success \p hsts will be initialized, else it will be left untouched.
+ *
+ * The returned \p hsts object can be used with functions like hsts_get_entry().
+ * When done you have to free the hsts object by calling hsts_free().
+ *
+ * Files larger than 20MB are rejected, see hsts_load_fp_limit() for larger lists.
+ *
+ * @return HSTS_SUCCESS on success, else another hsts_status_t value
+ *
+ * Since: 0.0.1
+ */
+hsts_status_t hsts_load_fp(FILE *fp, hsts_t **hsts)
+{
+	return hsts_load_fp_limit(fp, 0, hsts);
+}
+
+/**
+ * @param[in] fp FILE pointer of a HSTS data file
+ * @param[in] max_size Max. size of the HSTS data in bytes, 0 for the default of 20MB
+ * @param[out] hsts Returned HSTS data
+ *
+ * Same as hsts_load_fp(), but HSTS data of up to \p max_size bytes is accepted.
+ * A DAFSA takes about 10-12 bytes per entry, so lists with more than ~2M entries exceed
+ * the default. Their files use a format version with wide offsets (see hsts-make-dafsa).
+ *
+ * @return HSTS_SUCCESS on success, else another hsts_status_t value.
+ *   %HSTS_ERR_INPUT_TOO_LONG is returned if the data exceeds \p max_size.
+ *
+ * Since: 0.2.0
+ */
+hsts_status_t hsts_load_fp_limit(FILE *fp, size_t max_size, hsts_t **hsts)
+{
+	hsts_t *_hsts;
+	char buf[16];
+	int version;
+	void *m;
+	struct stat st;
+	size_t size, n, len = 0;
+	hsts_status_t rc;
+
+	if (!fp)
+		return HSTS_ERR_INVALID_ARG;
+
+	if (!max_size)
+		max_size = HSTS_DEFAULT_MAX_SIZE;
+
+	if ((n = fread(buf, 1, sizeof(buf), fp)) < sizeof(buf))
+		return ferror(fp) ? HSTS_ERR_INPUT_FAILURE : HSTS_ERR_INPUT_TOO_SHORT;
+
+	if ((version = _hsts_parse_header(buf)) < 0)
+		return (hsts_status_t) version;
+
+	if (!(_hsts = calloc(1, sizeof(hsts_t))))
+		return HSTS_ERR_NO_MEM;
+
+	size = 384 * 1024; /* 13.3.2018: the current size is ~340k, avoid reallocs */
+
+	/* large lists: read regular files in one go, one extra byte to see EOF without a realloc */
+	if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > (off_t) size && (size_t) st.st_size < max_size)
+		size = (size_t) st.st_size + 1;
+
+	if (!(_hsts->data = malloc(size))) {
+		hsts_free(_hsts);
+		return HSTS_ERR_NO_MEM;
+	}
+
+	while ((n = fread(_hsts->data + len, 1, size - len, fp)) > 0) {
+		len += n;
+		if (len > max_size) {
+			/* Apply a max. file size to avoid overflows / DOS attacks */
+			hsts_free(_hsts);
+			return HSTS_ERR_INPUT_TOO_LONG;
+		}
+		if (len >= size) {
+			if (!(m = realloc(_hsts->data, size = size <= max_size / 2 ? size * 2 : max_size + 1))) {
+				hsts_free(_hsts);
+				return HSTS_ERR_NO_MEM;
+			}
+			_hsts->data = m;
+		}
+	}
+
+	/* release unused memory */
+	if ((m = realloc(_hsts->data, len)))
+		_hsts->data = m;
+	else if (!len)
+		_hsts->data = NULL; /* realloc() just free'd hsts->data */
+	/* else we go on with the unshrunk data memory */
+
+	if ((rc = _hsts_init(_hsts, version, len)) != HSTS_SUCCESS) {
+		hsts_free(_hsts);
+		return rc;
+	}
+
+	if (hsts)
+		*hsts = _hsts;
+	else
+		hsts_free(_hsts);
+
+	return HSTS_SUCCESS;
+}
+
+#ifdef HSTS_WITH_MEMFD
+static int _hsts_write(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		if ((n = write(fd, p, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= (size_t) n;
+	}
+
+	return 0;
+}
+#endif
+
+/**
+ * \param[in] hsts HSTS data object
+ * \param[out] fd Returned file descriptor
+ *
+ * This function copies the HSTS data of \p hsts, including its file header, into a new memfd.
+ * The memfd is sealed, so neither this process nor a receiver can change, shrink or grow it.
+ *
+ * Pass \p fd to other processes (e.g. via SCM_RIGHTS over a unix socket or by fork()) and load
+ * it there with hsts_import_fd(). All importers share the same pages of memory.
+ * The lookup engine is not exported, each importer has to call hsts_set_engine() itself.
+ *
+ * The memfd has the close-on-exec flag set. When done, close \p fd with close().
+ *
+ * \return %HSTS_SUCCESS on success.
+ *   %HSTS_ERR_INVALID_ARG is returned if \p hsts or \p fd was %NULL.
+ *   %HSTS_ERR_NO_MEM is returned if the memfd could not be created or written.
+ *   %HSTS_ERR_NOT_SUPPORTED is returned if the system has no sealed memfds.
+ *
+ * Since: 0.2.0
+ */
+hsts_status_t hsts_export_memfd(const hsts_t *hsts, int *fd)
+{
+#ifdef HSTS_WITH_MEMFD
+	char header[17];
+	size_t len;
+	int _fd;
+
+	if (!hsts || !fd)
+		return HSTS_ERR_INVALID_ARG;
+
+	if ((_fd = memfd_create("libhsts", MFD_CLOEXEC | MFD_ALLOW_SEALING)) == -1)
+		return errno == ENOSYS || errno == EINVAL ? HSTS_ERR_NOT_SUPPORTED : HSTS_ERR_NO_MEM;
+
+	/* same header as written by hsts-make-dafsa */
+	snprintf(header, sizeof(header), ".DAFSA@HSTS_%d  \n", hsts->version);
+	len = hsts->data ? (size_t) (hsts->dafsa + hsts->dafsa_size - hsts->data) : 0;
+
+	if (_hsts_write(_fd, header, 16) || _hsts_write(_fd, hsts->data, len)) {
+		close(_fd);
+		return HSTS_ERR_NO_MEM;
+	}
+
+	if (fcntl(_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)) {
+		close(_fd);
+		return HSTS_ERR_NOT_SUPPORTED;
+	}
+
+	*fd = _fd;
+	return HSTS_SUCCESS;
+#else
+	(void) hsts; (void) fd;
+	return HSTS_ERR_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * \param[in] fd File descriptor of a sealed memfd created by hsts_export_memfd()
+ * \param[out] hsts Returned HSTS data
+ *
+ * This function maps the HSTS data of \p fd read-only into memory, no data is copied.
+ * Only the file header and the policy records are checked, so importing is cheap even for
+ * large lists. On success \p hsts will be initialized, else it will be left untouched.
+ *
+ * \p fd must be sealed against writing and shrinking, so that the data can't change under
+ * the lookups of this process. \p fd may be closed after this function returns.
+ * When done you have to free the hsts object by calling hsts_free().
+ *
+ * \return %HSTS_SUCCESS on success, else another hsts_status_t value.
+ *   %HSTS_ERR_INVALID_ARG is returned if \p fd is not a sealed memfd.
+ *   %HSTS_ERR_INPUT_FAILURE is returned if \p fd could not be mapped.
+ *   %HSTS_ERR_NOT_SUPPORTED is returned if the system has no sealed memfds.
+ *
+ * Since: 0.2.0
+ */
+hsts_status_t hsts_import_fd(int fd, hsts_t **hsts)
+{
+#ifdef HSTS_WITH_MEMFD
+	hsts_t *_hsts;
+	struct stat st;
+	unsigned char *map;
+	size_t size;
+	int seals, version;
+	hsts_status_t rc;
+
+	if (fd < 0)
+		return HSTS_ERR_INVALID_ARG;
+
+	/* the sender must not be able to change or truncate the data behind our back */
+	if ((seals = fcntl(fd, F_GET_SEALS)) == -1
+		|| (seals & (F_SEAL_WRITE | F_SEAL_SHRINK)) != (F_SEAL_WRITE | F_SEAL_SHRINK))
+		return HSTS_ERR_INVALID_ARG;
+
+	if (fstat(fd, &st))
+		return HSTS_ERR_INPUT_FAILURE;
+
+	if (st.st_size < 16)
+		return HSTS_ERR_INPUT_TOO_SHORT;
+
+	if ((uintmax_t) st.st_size > SIZE_MAX)
+		return HSTS_ERR_INPUT_TOO_LONG;
+
+	size = (size_t) st.st_size;
+
+	if ((map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		return HSTS_ERR_INPUT_FAILURE;
+
+	if ((version = _hsts_parse_header(map)) < 0) {
+		munmap(map, size);
+		return (hsts_status_t) version;
+	}
+
+	if (!(_hsts = calloc(1, sizeof(hsts_t)))) {
+		munmap(map, size);
+		return HSTS_ERR_NO_MEM;
+	}
+
+	_hsts->map = map;
+	_hsts->map_size = size;
+	_hsts->data = map + 16;
+
+	if ((rc = _hsts_init(_hsts, version, size - 16)) != HSTS_SUCCESS) {
+		hsts_free(_hsts);
+		return rc;
+	}
+
+	if (hsts)
+		*hsts = _hsts;
+	else
+		hsts_free(_hsts);
+
+	return HSTS_SUCCESS;
+#else
+	(void) fd; (void) hsts;
+	return HSTS_ERR_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * \param[in] entry HSTS entry to be freed
+ *
+ * This function frees the the HSTS entry that has been retrieved via hsts_search().
+ *
+ * Since: 0.0.1
+ */
+void hsts_free_entry(hsts_entry_t *entry)
+{
+	free(entry);
+}
+
+/**
+ * \param[in] hsts HSTS data pointer to be freed
+ *
+ * This function frees the the HSTS data object that has been retrieved via
+ * hsts_load_fp(), hsts_load_file() or hsts_import_fd().
+ *
+ * Since: 0.0.1
+ */
+void hsts_free(hsts_t *hsts)
+{
+	if (hsts) {
+		_hsts_free_hits(hsts);
+		PerfectHashFree(hsts->hash);
+		free(hsts->records);
+#ifdef HSTS_WITH_MEMFD
+		if (hsts->map)
+			munmap(hsts->map, hsts->map_size);
+		else
+#endif
+			free(hsts->data);
 		free(hsts);
 	}
 }
@@ -0,0 +1,379 @@
+/*
+ * Copyright(c) 2018 Tim Ruehsen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * This file is part of libhsts.
+ *
+ * Minimal perfect hash lookup engine
+ *
+ * All keys of a DAFSA are enumerated once and placed into a minimal perfect
+ * hash table ('hash and displace': keys are grouped into buckets, each bucket
+ * gets a seed that maps its keys to free slots, singleton buckets are placed
+ * directly). Each slot holds a 32-bit fingerprint to reject non-members,
+ * so a non-member is reported as found with a probability of 2^-32 per probe.
+ *
+ * Keys are hashed right-to-left, so a single pass over a host name yields
+ * the hashes of all of its label suffixes.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* prototypes */
+int EnumerateFixedSetRecords(const unsigned char*, size_t, int, int,
+	int (*)(void*, const char*, size_t, int, const unsigned char*), void*);
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/* max. number of seeds tried per bucket before giving up */
+#define MAX_SEED (1 << 20)
+
+/* max. length of a key, see EnumerateFixedSetRecords() */
+#define MAX_KEY_LENGTH 255
+
+struct slot {
+	uint32_t
+		fingerprint;
+	uint16_t
+		index, /* record index */
+		value; /* DAFSA return value */
+};
+
+typedef struct perfect_hash_st {
+	int32_t
+		*displace; /* per bucket: seed if >= 0, else -(slot + 1) */
+	struct slot
+		*slots;
+	uint32_t
+		nbuckets,
+		nslots;
+} perfect_hash_t;
+
+struct key {
+	uint64_t
+		hash;
+	uint32_t
+		bucket;
+	uint16_t
+		index,
+		value;
+};
+
+struct collect_ctx {
+	struct key
+		*keys;
+	size_t
+		nkeys,
+		size,
+		max_keys;
+	int
+		with_index;
+};
+
+/* final mixer of splitmix64 */
+static uint64_t Mix(uint64_t h)
+{
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
+}
+
+static uint32_t Slot(const perfect_hash_t *ph, uint64_t hash, int32_t seed)
+{
+	return (uint32_t) (Mix(hash + (uint64_t) seed * 0x9e3779b97f4a7c15ULL) % ph->nslots);
+}
+
+static int CollectKey(void *_ctx, const char *key, size_t key_length, int value, const unsigned char *value_pos)
+{
+	struct collect_ctx *ctx = _ctx;
+	struct key *k;
+	uint64_t h = FNV_OFFSET;
+
+	if (ctx->nkeys >= ctx->size) {
+		if (ctx->nkeys >= ctx->max_keys)
+			return -1; /* sanity limit for malformed data */
+
+		if (!(k = realloc(ctx->keys, (ctx->size = ctx->size ? ctx->size * 2 : 1024) * sizeof(struct key))))
+			return -1;
+
+		ctx->keys = k;
+	}
+
+	/* hash right-to-left, see PerfectHashSearch() */
+	while (key_length)
+		h = (h ^ (unsigned char) key[--key_length]) * FNV_PRIME;
+
+	k = &ctx->keys[ctx->nkeys++];
+	k->hash = Mix(h);
+	k->value = (uint16_t) value;
+	/* record index directly follows the return value (format version 1) */
+	k->index = ctx->with_index ? (uint16_t) ((value_pos[1] << 8) | value_pos[2]) : 0xFFFF;
+
+	return 0;
+}
+
+/* prototype to skip warning with -Wmissing-prototypes */
+void PerfectHashFree(perfect_hash_t *);
+
+void PerfectHashFree(perfect_hash_t *ph)
+{
+	if (ph) {
+		free(ph->displace);
+		free(ph->slots);
+		free(ph);
+	}
+}
+
+/* prototype to skip warning with -Wmissing-prototypes */
+perfect_hash_t *PerfectHashBuild(const unsigned char *, size_t, int, int);
+
+/*
+ * Builds a minimal perfect hash table over all keys in |graph|.
+ * If |with_index| is set, each return value is followed by a 16-bit record index.
+ * |wide| is set for graphs with wide offsets.
+ * Returns NULL on malformed data, on failure to find a perfect hash or if out of memory.
+ */
+perfect_hash_t *PerfectHashBuild(const unsigned char *graph, size_t length, int with_index, int wide)
+{
+	struct collect_ctx ctx;
+	perfect_hash_t *ph = NULL;
+	uint32_t *bucket_start = NULL, *order = NULL, *slots = NULL, *by_size = NULL;
+	unsigned char *used = NULL;
+	uint32_t it, max_size, next_free;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.with_index = with_index;
+	ctx.max_keys = length * 4;
+
+	if (EnumerateFixedSetRecords(graph, length, with_index, wide, CollectKey, &ctx) || !ctx.nkeys)
+		goto out;
+
+	if (!(ph = calloc(1, sizeof(perfect_hash_t))))
+		goto out;
+
+	ph->nslots = (uint32_t) ctx.nkeys;
+	ph->nbuckets = ph->nslots / 3 + 1; /* average bucket size 3 */
+
+	if (!(ph->displace = calloc(ph->nbuckets, sizeof(int32_t)))
+		|| !(ph->slots = calloc(ph->nslots, sizeof(struct slot)))
+		|| !(bucket_start = calloc(ph->nbuckets + 1, sizeof(uint32_t)))
+		|| !(order = malloc(ctx.nkeys * sizeof(uint32_t)))
+		|| !(by_size = malloc(ph->nbuckets * sizeof(uint32_t)))
+		|| !(used = calloc(ph->nslots, 1)))
+		goto fail;
+
+	/* group keys by bucket (counting sort) */
+	for (it = 0; it < ctx.nkeys; it++) {
+		ctx.keys[it].bucket = (uint32_t) (ctx.keys[it].hash % ph->nbuckets);
+		bucket_start[ctx.keys[it].bucket + 1]++;
+	}
+
+	for (max_size = 0, it = 0; it < ph->nbuckets; it++) {
+		if (bucket_start[it + 1] > max_size)
+			max_size = bucket_start[it + 1];
+		bucket_start[it + 1] += bucket_start[it];
+	}
+
+	for (it = 0; it < ctx.nkeys; it++)
+		order[bucket_start[ctx.keys[it].bucket]++] = it;
+
+	for (it = ph->nbuckets; it > 0; it--)
+		bucket_start[it] = bucket_start[it - 1];
+	bucket_start[0] = 0;
+
+	/* sort buckets by size, largest first (counting sort) */
+	{
+		uint32_t *count, size, n = 0;
+
+		if (!(count = calloc(max_size + 1, sizeof(uint32_t))))
+			goto fail;
+
+		for (it = 0; it < ph->nbuckets; it++)
+			count[bucket_start[it + 1] - bucket_start[it]]++;
+
+		for (size = max_size + 1; size-- > 0;) {
+			uint32_t c = count[size];
+			count[size] = n;
+			n += c;
+		}
+
+		for (it = 0; it < ph->nbuckets; it++)
+			by_size[count[bucket_start[it + 1] - bucket_start[it]]++] = it;
+
+		free(count);
+	}
+
+	if (!(slots = malloc((max_size + 1) * sizeof(uint32_t))))
+		goto fail;
+
+	for (next_free = 0, it = 0; it < ph->nbuckets; it++) {
+		uint32_t bucket = by_size[it], size = bucket_start[bucket + 1] - bucket_start[bucket], n;
+		const uint32_t *keys = order + bucket_start[bucket];
+		int32_t seed;
+
+		if (size == 0)
+			break;
+
+		if (size == 1) {
+			/* place singletons directly into the remaining free slots */
+			while (used[next_free])
+				next_free++;
+
+			slots[0] = next_free;
+			ph->displace[bucket] = -(int32_t) next_free - 1;
+		} else {
+			for (seed = 0; seed < MAX_SEED; seed++) {
+				for (n = 0; n < size; n++) {
+					uint32_t slot = Slot(ph, ctx.keys[keys[n]].hash, seed), m;
+
+					if (used[slot])
+						break;
+
+					for (m = 0; m < n && slots[m] != slot; m++);
+					if (m < n)
+						break;
+
+					slots[n] = slot;
+				}
+
+				if (n == size)
+					break;
+			}
+
+			if (seed == MAX_SEED)
+				goto fail; /* e.g. two keys with identical hash values */
+
+			ph->displace[bucket] = seed;
+		}
+
+		for (n = 0; n < size; n++) {
+			const struct key *k = &ctx.keys[keys[n]];
+			struct slot *s = &ph->slots[slots[n]];
+
+			used[slots[n]] = 1;
+			s->fingerprint = (uint32_t) (k->hash >> 32);
+			s->index = k->index;
+			s->value = k->value;
+		}
+	}
+
+	goto out;
+
+fail:
+	PerfectHashFree(ph);
+	ph = NULL;
+
+out:
+	free(slots);
+	free(used);
+	free(by_size);
+	free(order);
+	free(bucket_start);
+	free(ctx.keys);
+
+	return ph;
+}
+
+static const struct slot *Probe(const perfect_hash_t *ph, uint64_t h)
+{
+	uint64_t hash = Mix(h);
+	int32_t displace = ph->displace[hash % ph->nbuckets];
+	const struct slot *s;
+
+	if (displace < 0)
+		s = &ph->slots[-(displace + 1)];
+	else
+		s = &ph->slots[Slot(ph, hash, displace)];
+
+	return s->fingerprint == (uint32_t) (hash >> 32) ? s : NULL;
+}
+
+/* prototype to skip warning with -Wmissing-prototypes */
+int PerfectHashSearch(const perfect_hash_t *, const char *, size_t, int *, int *, int *);
+
+/*
+ * Looks up |domain| and its label suffixes, longest first, and returns the
+ * value of the first one found or -1. On success |index| receives the record
+ * index (0xFFFF if none), |slot| the slot of the entry (a dense index in the
+ * range [0, PerfectHashCount()) ) and |is_suffix| is set if a proper suffix
+ * of |domain| was found.
+ */
+int PerfectHashSearch(const perfect_hash_t *ph, const char *domain, size_t length, int *index, int *slot, int *is_suffix)
+{
+	uint64_t hashes[MAX_KEY_LENGTH], h = FNV_OFFSET;
+	size_t pos = length;
+	int nhashes = 0, it;
+
+	/* collect the hashes of all suffixes starting at a label, shortest first.
+	 * Suffixes longer than any key can't be found and are skipped. */
+	while (pos && length - pos < MAX_KEY_LENGTH) {
+		h = (h ^ (unsigned char) domain[--pos]) * FNV_PRIME;
+
+		if (pos == 0 || domain[pos - 1] == '.')
+			hashes[nhashes++] = h;
+	}
+
+	for (it = nhashes - 1; it >= 0; it--) {
+		const struct slot *s = Probe(ph, hashes[it]);
+
+		if (s) {
+			*index = s->index;
+			*slot = (int) (s - ph->slots);
+			*is_suffix = it != nhashes - 1 || pos != 0;
+			return s->value;
+		}
+	}
+
+	return -1;
+}
+
+/* prototype to skip warning with -Wmissing-prototypes */
+int PerfectHashSlot(const perfect_hash_t *, const char *, size_t);
+
+/* Returns the slot of the entry |key| or -1 if |key| is not an entry. */
+int PerfectHashSlot(const perfect_hash_t *ph, const char *key, size_t length)
+{
+	uint64_t h = FNV_OFFSET;
+	const struct slot *s;
+
+	while (length)
+		h = (h ^ (unsigned char) key[--length]) * FNV_PRIME;
+
+	return (s = Probe(ph, h)) ? (int) (s - ph->slots) : -1;
+}
+
+/* prototype to skip warning with -Wmissing-prototypes */
+size_t PerfectHashCount(const perfect_hash_t *);
+
+/* Returns the number of entries (and slots) of |ph|. */
+size_t PerfectHashCount(const perfect_hash_t *ph)
+{
+	return ph->nslots;
+}
@@ -5,10 +5,22 @@
  * Converted to C89 2015 by Tim Rühsen
  */
 
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
 #include <stddef.h>
+#include <stdint.h>
 
 #define CHECK_LT(a, b) if ((a) >= b) return 0
 
+/* the lookup core has to be inlined to be specialized for the |utf_mode| and |wide| constants */
+#if defined(__GNUC__) && (__GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 1))
+#  define LOOKUP_INLINE inline __attribute__ ((always_inline))
+#else
+#  define LOOKUP_INLINE inline
+#endif
+
 static const char multibyte_length_table[16] = {
 	0, 0, 0, 0,	 /* 0x00-0x3F */
 	0, 0, 0, 0,	 /* 0x40-0x7F */
@@ -25,15 +37,25 @@ static int GetMultibyteLength(char c) {
 	return multibyte_length_table[((unsigned char)c) >> 4];
 }
 
+/*
+ * The lookup functions below are instantiated through constant |utf_mode|
+ * and |wide| parameters: for graphs generated with --encoding=ascii all
+ * multibyte handling is optimized away, |wide| selects 3 or 5 byte <offset3>
+ * links (format versions 2 and 3, see hsts-make-dafsa).
+ */
+
 /*
  * Moves pointers one byte forward.
  */
-static void NextPos(const unsigned char** pos,
+static inline void NextPos(const unsigned char** pos,
 	const char** key,
-	const char** multibyte_start)
+	const char** multibyte_start,
+	const int utf_mode)
 {
 	++*pos;
-	if (*multibyte_start) {
+	if (!utf_mode) {
+		++*key;
+	} else if (*multibyte_start) {
 		/* Advance key to next byte in multibyte sequence. */
 		++*key;
 		/* Reset multibyte_start if last byte in multibyte sequence was consumed. */
@@ -56,9 +78,10 @@ static void NextPos(const unsigned char** pos,
  * Returns true if an offset could be read, false otherwise.
  */
 
-static int GetNextOffset(const unsigned char** pos,
+static LOOKUP_INLINE int GetNextOffset(const unsigned char** pos,
 	const unsigned char* end,
-	const unsigned char** offset)
+	const unsigned char** offset,
+	const int wide)
 {
 	size_t bytes_consumed;
 
@@ -71,7 +94,24 @@ static int GetNextOffset(const unsigned char** pos,
 	 * than one byte. */
 	CHECK_LT(*pos + 2, end);
 	switch (**pos & 0x60) {
-	case 0x60: /* Read three byte offset */
+	case 0x60:
+		if (wide && ((*pos)[0] & 0x10)) { /* Read five byte offset */
+			uint64_t value;
+
+			CHECK_LT(*pos + 4, end);
+			value = ((uint64_t) ((*pos)[0] & 0x0F) << 32) | ((uint64_t) (*pos)[1] << 24)
+				| ((*pos)[2] << 16) | ((*pos)[3] << 8) | (*pos)[4];
+			CHECK_LT(value, (uint64_t) (end - *offset));
+			*offset += (size_t) value;
+			bytes_consumed = 5;
+			break;
+		}
+		if (wide) { /* Read three byte offset, 20 bits */
+			*offset += (((*pos)[0] & 0x0F) << 16) | ((*pos)[1] << 8) | (*pos)[2];
+			bytes_consumed = 3;
+			break;
+		}
+		/* Read three byte offset */
 		*offset += (((*pos)[0] & 0x1F) << 16) | ((*pos)[1] << 8) | (*pos)[2];
 		bytes_consumed = 3;
 		break;
@@ -106,10 +146,13 @@ static int IsEOL(const unsigned char* offset, const unsigned char* end)
  * This version assumes a range check was already performed by the caller.
  */
 
-static int IsMatchUnchecked(const unsigned char matcher,
+static inline int IsMatchUnchecked(const unsigned char matcher,
 	const char* key,
-	const char* multibyte_start)
+	const char* multibyte_start,
+	const int utf_mode)
 {
+	if (!utf_mode)
+		return matcher == (const unsigned char)*key;
 	if (multibyte_start) {
 		/* Multibyte matching mode. */
 		if (multibyte_start == key) {
@@ -135,13 +178,14 @@ static int IsMatchUnchecked(const unsigned char matcher,
  * This version matches characters not last in label.
  */
 
-static int IsMatch(const unsigned char* offset,
+static inline int IsMatch(const unsigned char* offset,
 	const unsigned char* end,
 	const char* key,
-	const char* multibyte_start)
+	const char* multibyte_start,
+	const int utf_mode)
 {
 	CHECK_LT(offset, end);
-	return IsMatchUnchecked(*offset, key, multibyte_start);
+	return IsMatchUnchecked(*offset, key, multibyte_start, utf_mode);
 }
 
 /*
@@ -149,13 +193,14 @@ static int IsMatch(const unsigned char* offset,
  * This version matches characters last in label.
  */
 
-static int IsEndCharMatch(const unsigned char* offset,
+static inline int IsEndCharMatch(const unsigned char* offset,
 	const unsigned char* end,
 	const char* key,
-	const char* multibyte_start)
+	const char* multibyte_start,
+	const int utf_mode)
 {
 	CHECK_LT(offset, end);
-	return IsMatchUnchecked(*offset ^ 0x80, key, multibyte_start);
+	return IsMatchUnchecked(*offset ^ 0x80, key, multibyte_start, utf_mode);
 }
 
 /*
@@ -163,13 +208,14 @@ static int IsEndCharMatch(const unsigned char* offset,
  * Returns true if a return value could be read, false otherwise.
  */
 
-static int GetReturnValue(const unsigned char* offset,
+static inline int GetReturnValue(const unsigned char* offset,
 	const unsigned char* end,
 	const char* multibyte_start,
-	int* return_value)
+	int* return_value,
+	const int utf_mode)
 {
 	CHECK_LT(offset, end);
-	if (!multibyte_start && (*offset & 0xE0) == 0x80) {
+	if ((!utf_mode || !multibyte_start) && (*offset & 0xE0) == 0x80) {
 		*return_value = *offset & 0x0F;
 		return 1;
 	}
@@ -190,13 +236,13 @@ static int GetReturnValue(const unsigned char* offset,
  * Lookup a domain key in a byte array generated by hsts-make-dafsa.
  */
 
-/* prototype to skip warning with -Wmissing-prototypes */
-int LookupStringInFixedSet(const unsigned char*, size_t,const char*, size_t);
-
-int LookupStringInFixedSet(const unsigned char* graph,
+static LOOKUP_INLINE int LookupString(const unsigned char* graph,
 	size_t length,
 	const char* key,
-	size_t key_length)
+	size_t key_length,
+	const unsigned char** value_pos,
+	const int utf_mode,
+	const int wide)
 {
 	const unsigned char* pos = graph;
 	const unsigned char* end = graph + length;
@@ -204,7 +250,7 @@ int LookupStringInFixedSet(const unsigned char* graph,
 	const char* key_end = key + key_length;
 	const char* multibyte_start = 0;
 
-	while (GetNextOffset(&pos, end, &offset)) {
+	while (GetNextOffset(&pos, end, &offset, wide)) {
 		/*char <char>+ end_char offsets
 		 * char <char>+ return value
 		 * char end_char offsets
@@ -216,10 +262,10 @@ int LookupStringInFixedSet(const unsigned char* graph,
 
 		if (key != key_end && !IsEOL(offset, end)) {
 			/* Leading <char> is not a match. Don't dive into this child */
-			if (!IsMatch(offset, end, key, multibyte_start))
+			if (!IsMatch(offset, end, key, multibyte_start, utf_mode))
 				continue;
 			did_consume = 1;
-			NextPos(&offset, &key, &multibyte_start);
+			NextPos(&offset, &key, &multibyte_start, utf_mode);
 			/* Possible matches at this point:
 			 * <char>+ end_char offsets
 			 * <char>+ return value
@@ -229,9 +275,9 @@ int LookupStringInFixedSet(const unsigned char* graph,
 
 			/* Remove all remaining <char> nodes possible */
 			while (!IsEOL(offset, end) && key != key_end) {
-				if (!IsMatch(offset, end, key, multibyte_start))
+				if (!IsMatch(offset, end, key, multibyte_start, utf_mode))
 					return -1;
-				NextPos(&offset, &key, &multibyte_start);
+				NextPos(&offset, &key, &multibyte_start, utf_mode);
 			}
 		}
 		/* Possible matches at this point:
@@ -243,8 +289,11 @@ int LookupStringInFixedSet(const unsigned char* graph,
 		if (key == key_end) {
 			int return_value;
 
-			if (GetReturnValue(offset, end, multibyte_start, &return_value))
+			if (GetReturnValue(offset, end, multibyte_start, &return_value, utf_mode)) {
+				if (value_pos)
+					*value_pos = offset;
 				return return_value;
+			}
 			/* The DAFSA guarantees that if the first char is a match, all
 			 * remaining char elements MUST match if the key is truly present.
 			 */
@@ -252,18 +301,206 @@ int LookupStringInFixedSet(const unsigned char* graph,
 				return -1;
 			continue;
 		}
-		if (!IsEndCharMatch(offset, end, key, multibyte_start)) {
+		if (!IsEndCharMatch(offset, end, key, multibyte_start, utf_mode)) {
 			if (did_consume)
 				return -1; /* Unexpected */
 			continue;
 		}
-		NextPos(&offset, &key, &multibyte_start);
+		NextPos(&offset, &key, &multibyte_start, utf_mode);
 		pos = offset; /* Dive into child */
 	}
 
 	return -1; /* No match */
 }
 
+/* prototype to skip warning with -Wmissing-prototypes */
+int LookupStringInFixedSetPos(const unsigned char*, size_t,const char*, size_t, const unsigned char**);
+
+/*
+ * Same as LookupStringInFixedSet(), but on success also returns the position
+ * of the return value byte in |value_pos| (if not NULL). The caller may find
+ * additional per-entry data (e.g. a record index) directly after that byte.
+ */
+int LookupStringInFixedSetPos(const unsigned char* graph,
+	size_t length,
+	const char* key,
+	size_t key_length,
+	const unsigned char** value_pos)
+{
+	return LookupString(graph, length, key, key_length, value_pos, 1, 0);
+}
+
+/* prototype to skip warning with -Wmissing-prototypes */
+int LookupStringInFixedSetAsciiPos(const unsigned char*, size_t,const char*, size_t, const unsigned char**);
+
+/*
+ * Same as LookupStringInFixedSetPos(), but only for graphs generated with
+ * --encoding=ascii (see GetUtfMode()). Keys with non-ASCII characters never
+ * match, callers should reject them before the lookup.
+ */
+int LookupStringInFixedSetAsciiPos(const unsigned char* graph,
+	size_t length,
+	const char* key,
+	size_t key_length,
+	const unsigned char** value_pos)
+{
+	return LookupString(graph, length, key, key_length, value_pos, 0, 0);
+}
+
+/* prototype to skip warning with -Wmissing-prototypes */
+int LookupStringInFixedSetWidePos(const unsigned char*, size_t,const char*, size_t, const unsigned char**);
+
+/*
+ * Same as LookupStringInFixedSetPos(), but for graphs with wide offsets.
+ */
+int LookupStringInFixedSetWidePos(const unsigned char* graph,
+	size_t length,
+	const char* key,
+	size_t key_length,
+	const unsigned char** value_pos)
+{
+	return LookupString(graph, length, key, key_length, value_pos, 1, 1);
+}
+
+/* prototype to skip warning with -Wmissing-prototypes */
+int LookupStringInFixedSetAsciiWidePos(const unsigned char*, size_t,const char*, size_t, const unsigned char**);
+
+/*
+ * Same as LookupStringInFixedSetAsciiPos(), but for graphs with wide offsets.
+ */
+int LookupStringInFixedSetAsciiWidePos(const unsigned char* graph,
+	size_t length,
+	const char* key,
+	size_t key_length,
+	const unsigned char** value_pos)
+{
+	return LookupString(graph, length, key, key_length, value_pos, 0, 1);
+}
+
+/* prototype to skip warning with -Wmissing-prototypes */
+int LookupStringInFixedSet(const unsigned char*, size_t,const char*, size_t);
+
+int LookupStringInFixedSet(const unsigned char* graph,
+	size_t length,
+	const char* key,
+	size_t key_length)
+{
+	return LookupStringInFixedSetPos(graph, length, key, key_length, 0);
+}
+
+/*
+ * Recursively enumerates the words reachable from the offset list at |pos|.
+ * |multibyte_length| is -1 after a 0x1F mode switch byte, >0 while inside of
+ * a multibyte sequence, else 0.
+ */
+static int EnumerateOffsets(const unsigned char* pos,
+	const unsigned char* end,
+	char* buf,
+	size_t buf_length,
+	size_t key_length,
+	int multibyte_length,
+	int wide,
+	int (*callback)(void*, const char*, size_t, int, const unsigned char*),
+	void* ctx)
+{
+	const unsigned char* offset = pos;
+
+	while (GetNextOffset(&pos, end, &offset, wide)) {
+		const unsigned char* label = offset;
+		size_t length = key_length;
+		int mb = multibyte_length;
+		int rc;
+
+		for (;; label++) {
+			unsigned char c;
+
+			if (label >= end)
+				return -1;
+
+			c = *label;
+			if (!mb && (c & 0xF0) == 0x80) {
+				/* <return value> */
+				if ((rc = callback(ctx, buf, length, c & 0x0F, label)))
+					return rc;
+				break;
+			}
+
+			if (length >= buf_length)
+				return -1; /* key too long */
+
+			if (mb == 0 && (c & 0x7F) == 0x1F) {
+				mb = -1;
+			} else if (mb == -1) {
+				buf[length] = (char) ((c & 0x7F) ^ 0x80);
+				if (!(mb = GetMultibyteLength(buf[length++]) - 1))
+					return -1;
+			} else if (mb > 0) {
+				buf[length++] = (char) ((c & 0x7F) ^ 0xC0);
+				mb--;
+			} else
+				buf[length++] = (char) (c & 0x7F);
+
+			if (c & 0x80) {
+				/* <end_char>, the offsets of the child nodes follow */
+				if ((rc = EnumerateOffsets(label + 1, end, buf, buf_length, length, mb, wide, callback, ctx)))
+					return rc;
+				break;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Calls |callback| for each key stored in |graph| with the decoded (UTF-8)
+ * key, its return value and the position of the return value byte.
+ * Keys are limited to 255 bytes. |wide| is set for graphs with wide offsets.
+ * A non-zero return value of |callback| stops the enumeration and is returned.
+ * Returns -1 on malformed data, else 0.
+ */
+
+/* prototype to skip warning with -Wmissing-prototypes */
+int EnumerateFixedSet(const unsigned char*, size_t, int,
+	int (*)(void*, const char*, size_t, int, const unsigned char*), void*);
+
+int EnumerateFixedSet(const unsigned char* graph,
+	size_t length,
+	int wide,
+	int (*callback)(void*, const char*, size_t, int, const unsigned char*),
+	void* ctx)
+{
+	char buf[256];
+
+	return EnumerateOffsets(graph, graph + length, buf, sizeof(buf), 0, 0, wide, callback, ctx);
+}
+
+/*
+ * Same as EnumerateFixedSet(), but if |with_index| is set, each return value
+ * of |graph| is followed by a 16-bit record index. The graph has to end with
+ * a return value, so the index of the last key is not part of the graph.
+ */
+
+/* prototype to skip warning with -Wmissing-prototypes */
+int EnumerateFixedSetRecords(const unsigned char*, size_t, int, int,
+	int (*)(void*, const char*, size_t, int, const unsigned char*), void*);
+
+int EnumerateFixedSetRecords(const unsigned char* graph,
+	size_t length,
+	int with_index,
+	int wide,
+	int (*callback)(void*, const char*, size_t, int, const unsigned char*),
+	void* ctx)
+{
+	if (with_index) {
+		if (length < 2)
+			return -1;
+		length -= 2;
+	}
+
+	return EnumerateFixedSet(graph, length, wide, callback, ctx);
+}
+
 /* prototype to skip warning with -Wmissing-prototypes */
 int GetUtfMode(const unsigned char *graph, size_t length);
 
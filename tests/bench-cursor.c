@@ -0,0 +1,259 @@
+/*
+ * Copyright(c) 2018 Tim Ruehsen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * This file is part of the test suite of libhsts.
+ *
+ * Compares hsts_cursor_search() with hsts_search() on a corpus sorted in
+ * reversed-domain order, like the host list of a crawler frontier.
+ * Not run by 'make check', build with 'make bench-cursor'.
+ *
+ * The corpus is generated from a trace file: each host of the trace plus
+ * synthetic subdomains 'h<n>.<host>' until the requested size is reached.
+ *
+ * Example:
+ *   ./bench-cursor trace.txt hsts.dafsa 10000000
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include <libhsts.h>
+
+static char **trace, **hosts, *arena;
+static size_t ntrace, nhosts;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int load_trace(const char *fname)
+{
+	FILE *fp;
+	char buf[256], *host;
+	size_t len, size = 0;
+
+	if (!(fp = fopen(fname, "r")))
+		return -1;
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		for (host = buf; isspace(*host); host++);
+		if (*host == '#' || !*host) continue;
+		for (len = 0; host[len] && !isspace(host[len]); len++);
+		host[len] = 0;
+
+		if (ntrace >= size) {
+			char **tmp = realloc(trace, (size = size ? size * 2 : 4096) * sizeof(char *));
+
+			if (!tmp)
+				break;
+			trace = tmp;
+		}
+
+		if (!(trace[ntrace] = strdup(host)))
+			break;
+		ntrace++;
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+/* builds n hosts from the trace, all host names share one memory block */
+static int make_corpus(size_t n)
+{
+	size_t it, size = 0, pos = 0;
+
+	for (it = 0; it < n; it++)
+		size += strlen(trace[it % ntrace]) + 1 + (it >= ntrace ? 18 : 0);
+
+	if (!(hosts = malloc(n * sizeof(char *))) || !(arena = malloc(size)))
+		return -1;
+
+	for (it = 0; it < n; it++) {
+		hosts[it] = arena + pos;
+
+		if (it < ntrace)
+			pos += sprintf(arena + pos, "%s", trace[it]) + 1;
+		else
+			pos += sprintf(arena + pos, "h%zx.%s", it / ntrace, trace[it % ntrace]) + 1;
+	}
+
+	nhosts = n;
+	return 0;
+}
+
+/* compares host names label by label, starting with the TLD */
+static int reversed_domain_cmp(const void *p1, const void *p2)
+{
+	const char *s1 = *(char * const *) p1, *s2 = *(char * const *) p2;
+	const char *e1 = s1 + strlen(s1), *e2 = s2 + strlen(s2);
+
+	while (e1 > s1 && e2 > s2) {
+		const char *l1 = e1, *l2 = e2;
+		size_t n1, n2;
+		int rc;
+
+		while (l1 > s1 && l1[-1] != '.') l1--;
+		while (l2 > s2 && l2[-1] != '.') l2--;
+
+		n1 = (size_t) (e1 - l1);
+		n2 = (size_t) (e2 - l2);
+
+		if ((rc = memcmp(l1, l2, n1 < n2 ? n1 : n2)))
+			return rc;
+		if (n1 != n2)
+			return n1 < n2 ? -1 : 1;
+
+		e1 = l1 > s1 ? l1 - 1 : l1;
+		e2 = l2 > s2 ? l2 - 1 : l2;
+	}
+
+	return (e1 > s1) - (e2 > s2);
+}
+
+static double bench_search(const hsts_t *hsts, size_t *found)
+{
+	double start = now();
+	size_t it;
+
+	for (*found = 0, it = 0; it < nhosts; it++) {
+		if (hsts_search(hsts, hosts[it], 0, NULL) == HSTS_SUCCESS)
+			(*found)++;
+	}
+
+	return (now() - start) * 1e9 / nhosts;
+}
+
+static double bench_cursor(const hsts_t *hsts, size_t *found)
+{
+	hsts_cursor_t *cursor;
+	double start;
+	size_t it;
+
+	if (hsts_cursor_new(hsts, &cursor) != HSTS_SUCCESS)
+		return 0;
+
+	start = now();
+
+	for (*found = 0, it = 0; it < nhosts; it++) {
+		if (hsts_cursor_search(cursor, hosts[it], 0, NULL) == HSTS_SUCCESS)
+			(*found)++;
+	}
+
+	start = now() - start;
+	hsts_cursor_free(cursor);
+
+	return start * 1e9 / nhosts;
+}
+
+/* checks the cursor results against hsts_search() */
+static size_t verify(const hsts_t *hsts)
+{
+	hsts_cursor_t *cursor;
+	size_t it, errors = 0;
+
+	if (hsts_cursor_new(hsts, &cursor) != HSTS_SUCCESS)
+		return nhosts;
+
+	for (it = 0; it < nhosts; it++) {
+		hsts_entry_t *e1 = NULL, *e2 = NULL;
+
+		if (hsts_search(hsts, hosts[it], 0, &e1) != hsts_cursor_search(cursor, hosts[it], 0, &e2)
+			|| hsts_has_include_subdomains(e1) != hsts_has_include_subdomains(e2))
+		{
+			if (errors++ < 10)
+				fprintf(stderr, "Mismatch for '%s'\n", hosts[it]);
+		}
+
+		hsts_free_entry(e2);
+		hsts_free_entry(e1);
+	}
+
+	hsts_cursor_free(cursor);
+	return errors;
+}
+
+int main(int argc, const char * const *argv)
+{
+	hsts_t *hsts;
+	size_t n = 10000000, found1, found2, errors;
+	double start, search_ns, cursor_ns;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <trace file> <dafsa file> [number of hosts]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc > 3)
+		n = (size_t) atol(argv[3]);
+
+	if (load_trace(argv[1]) || !ntrace) {
+		fprintf(stderr, "Failed to read host names from %s\n", argv[1]);
+		return 1;
+	}
+
+	if (hsts_load_file(argv[2], &hsts) != HSTS_SUCCESS) {
+		fprintf(stderr, "Failed to load %s\n", argv[2]);
+		return 1;
+	}
+
+	if (!n || make_corpus(n)) {
+		fprintf(stderr, "Failed to build a corpus of %zu hosts\n", n);
+		return 1;
+	}
+
+	search_ns = bench_search(hsts, &found1);
+	cursor_ns = bench_cursor(hsts, &found2);
+	printf("unsorted:  search %.1f ns/host (%zu found), cursor %.1f ns/host (%zu found)\n",
+		search_ns, found1, cursor_ns, found2);
+
+	start = now();
+	qsort(hosts, nhosts, sizeof(char *), reversed_domain_cmp);
+	printf("%zu hosts sorted in %.1f s\n", nhosts, now() - start);
+
+	search_ns = bench_search(hsts, &found1);
+	cursor_ns = bench_cursor(hsts, &found2);
+	printf("sorted:    search %.1f ns/host (%zu found), cursor %.1f ns/host (%zu found)\n",
+		search_ns, found1, cursor_ns, found2);
+
+	errors = verify(hsts);
+	printf("verify: %zu mismatches\n", errors);
+
+	hsts_free(hsts);
+	free(arena);
+	free(hosts);
+	while (ntrace)
+		free(trace[--ntrace]);
+	free(trace);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright(c) 2018 Tim Ruehsen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * This file is part of the test suite of libhsts.
+ *
+ * Replays a trace of host names against HSTS data files.
+ * Not run by 'make check', build with 'make bench-hsts'.
+ *
+ * Example (measure cache misses of a profiled layout):
+ *   perf stat -e L1-dcache-load-misses,l2_rqsts.miss ./bench-hsts trace.txt hsts.dafsa
+ *
+ * With BENCH_HITS=1, hit counting is enabled (see hsts_set_hit_counting()).
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#ifdef __GLIBC__
+#	include <malloc.h>
+#endif
+
+#include <libhsts.h>
+
+static char **hosts;
+static size_t nhosts;
+static int count_hits;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int load_trace(const char *fname)
+{
+	FILE *fp;
+	char buf[256], *host;
+	size_t len, size = 0;
+
+	if (!(fp = fopen(fname, "r")))
+		return -1;
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		for (host = buf; isspace(*host); host++);
+		if (*host == '#' || !*host) continue;
+		for (len = 0; host[len] && !isspace(host[len]); len++);
+		host[len] = 0;
+
+		if (nhosts >= size) {
+			char **tmp = realloc(hosts, (size = size ? size * 2 : 4096) * sizeof(char *));
+
+			if (!tmp)
+				break;
+			hosts = tmp;
+		}
+
+		if (!(hosts[nhosts] = strdup(host)))
+			break;
+		nhosts++;
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+static size_t heap_used(void)
+{
+#if defined __GLIBC__ && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	struct mallinfo2 mi = mallinfo2();
+
+	return mi.uordblks + mi.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+static double bench_lookups(const hsts_t *hsts, char **list, size_t n, int rounds)
+{
+	double start = now();
+	size_t it;
+	int round;
+
+	for (round = 0; round < rounds; round++) {
+		for (it = 0; it < n; it++)
+			hsts_search(hsts, list[it], 0, NULL);
+	}
+
+	return n ? (now() - start) * 1e9 / ((double) n * rounds) : 0;
+}
+
+static void bench_file(const char *fname, hsts_engine_t engine, int rounds)
+{
+	static const char *engine_names[] = { "dafsa", "hash", "dafsa+hits", "hash+hits" };
+	hsts_t *hsts;
+	const char *name = engine_names[engine + (count_hits ? 2 : 0)];
+	double start, load_secs, setup_secs;
+	size_t it, nhits = 0, nmisses = 0, mem;
+	char **hits, **misses;
+
+	mem = heap_used();
+	start = now();
+	if (hsts_load_file(fname, &hsts) != HSTS_SUCCESS) {
+		fprintf(stderr, "Failed to load %s\n", fname);
+		return;
+	}
+	load_secs = now() - start;
+
+	start = now();
+	if (hsts_set_engine(hsts, engine) != HSTS_SUCCESS) {
+		fprintf(stderr, "Failed to set up engine %s for %s\n", name, fname);
+		hsts_free(hsts);
+		return;
+	}
+	if (count_hits && hsts_set_hit_counting(hsts, 1) != HSTS_SUCCESS) {
+		fprintf(stderr, "Failed to enable hit counting for %s\n", fname);
+		hsts_free(hsts);
+		return;
+	}
+	setup_secs = now() - start;
+	mem = heap_used() - mem;
+
+	/* separate hits from misses */
+	hits = malloc(nhosts * sizeof(char *));
+	misses = malloc(nhosts * sizeof(char *));
+	if (!hits || !misses) {
+		free(hits);
+		free(misses);
+		hsts_free(hsts);
+		return;
+	}
+
+	for (it = 0; it < nhosts; it++) {
+		if (hsts_search(hsts, hosts[it], 0, NULL) == HSTS_SUCCESS)
+			hits[nhits++] = hosts[it];
+		else
+			misses[nmisses++] = hosts[it];
+	}
+
+	printf("%s [%s]: load %.3f ms, engine setup %.3f ms, heap %zu bytes\n",
+		fname, name, load_secs * 1000, setup_secs * 1000, mem);
+	printf("%s [%s]: %.1f ns/lookup (%zu hosts), hit %.1f ns (%zu), miss %.1f ns (%zu)\n",
+		fname, name, bench_lookups(hsts, hosts, nhosts, rounds), nhosts,
+		bench_lookups(hsts, hits, nhits, rounds), nhits,
+		bench_lookups(hsts, misses, nmisses, rounds), nmisses);
+
+	free(misses);
+	free(hits);
+	hsts_free(hsts);
+}
+
+int main(int argc, const char * const *argv)
+{
+	int rounds = 10, it;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <trace file> <dafsa file>...\n", argv[0]);
+		return 1;
+	}
+
+	if (getenv("BENCH_ROUNDS"))
+		rounds = atoi(getenv("BENCH_ROUNDS"));
+
+	if (getenv("BENCH_HITS"))
+		count_hits = atoi(getenv("BENCH_HITS"));
+
+	if (load_trace(argv[1]) || !nhosts) {
+		fprintf(stderr, "Failed to read host names from %s\n", argv[1]);
+		return 1;
+	}
+
+	for (it = 2; it < argc; it++) {
+		bench_file(argv[it], HSTS_ENGINE_DAFSA, rounds);
+		bench_file(argv[it], HSTS_ENGINE_HASH, rounds);
+	}
+
+	while (nhosts)
+		free(hosts[--nhosts]);
+	free(hosts);
+
+	return 0;
+}
@@ -0,0 +1,245 @@
+/*
+ * Copyright(c) 2018 Tim Ruehsen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * This file is part of the test suite of libhsts.
+ *
+ * Checks the code generated by 'hsts-make-dafsa --output-format=c-matcher'
+ * on all entries of the list and near misses, and compares the speed with the
+ * DAFSA interpreter.
+ *
+ * The expected results come from the entries themselves, not from the
+ * interpreter: LookupStringInFixedSet() returns 15 for some near misses of
+ * UTF-8 graphs (it takes the 0x9F multibyte marker for a return value).
+ * Such disagreements of the interpreter are only counted.
+ * Not run by 'make check' (the generated code takes minutes to compile),
+ * build and run with 'make check-matcher'.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* the interpreter is not exported by libhsts */
+#include "../src/lookup_string_in_fixed_set.c"
+
+/* hsts_matcher.c */
+int LookupStringInFixedSetCompiled(const unsigned char*, size_t, const char*, size_t);
+
+struct probe {
+	char
+		*key;
+	size_t
+		length;
+	int
+		value; /* expected return value */
+};
+
+struct probes {
+	struct probe
+		*probe;
+	size_t
+		nprobes,
+		size;
+};
+
+/* entries of the list and the keys to look up */
+static struct probes entries, probes;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int add_probe(struct probes *p, const char *key, size_t length, int value)
+{
+	if (p->nprobes >= p->size) {
+		struct probe *tmp = realloc(p->probe, (p->size = p->size ? p->size * 2 : 4096) * sizeof(struct probe));
+
+		if (!tmp)
+			return -1;
+		p->probe = tmp;
+	}
+
+	if (!(p->probe[p->nprobes].key = malloc(length + 1)))
+		return -1;
+
+	memcpy(p->probe[p->nprobes].key, key, length);
+	p->probe[p->nprobes].key[length] = 0;
+	p->probe[p->nprobes].length = length;
+	p->probe[p->nprobes++].value = value;
+
+	return 0;
+}
+
+static void free_probes(struct probes *p)
+{
+	size_t it;
+
+	for (it = 0; it < p->nprobes; it++)
+		free(p->probe[it].key);
+	free(p->probe);
+}
+
+static int probe_cmp(const void *p1, const void *p2)
+{
+	const struct probe *a = p1, *b = p2;
+
+	if (a->length != b->length)
+		return a->length < b->length ? -1 : 1;
+
+	return memcmp(a->key, b->key, a->length);
+}
+
+/*
+ * adds each entry and near misses: one character less or more and, for UTF-8 entries,
+ * the part before the first multibyte character. The expected values are set by set_expected().
+ */
+static int collect(void *ctx, const char *key, size_t length, int value, const unsigned char *value_pos)
+{
+	char buf[256];
+	size_t it;
+
+	(void) ctx; (void) value_pos;
+
+	if (add_probe(&entries, key, length, value) || add_probe(&probes, key, length, -1) || add_probe(&probes, key, length - 1, -1))
+		return -1;
+
+	for (it = 0; it < length && !(key[it] & 0x80); it++);
+	if (it > 0 && it < length && add_probe(&probes, key, it, -1))
+		return -1;
+
+	if (length < sizeof(buf) - 1) {
+		memcpy(buf, key, length);
+		buf[length] = '-';
+		return add_probe(&probes, buf, length + 1, -1);
+	}
+
+	return 0;
+}
+
+/* a probe is expected to return the value of the entry with the same key, else -1 */
+static void set_expected(void)
+{
+	size_t it;
+
+	qsort(entries.probe, entries.nprobes, sizeof(struct probe), probe_cmp);
+
+	for (it = 0; it < probes.nprobes; it++) {
+		const struct probe *entry = bsearch(&probes.probe[it], entries.probe, entries.nprobes, sizeof(struct probe), probe_cmp);
+
+		probes.probe[it].value = entry ? entry->value : -1;
+	}
+}
+
+static unsigned char *load_dafsa(const char *fname, size_t *length)
+{
+	FILE *fp;
+	unsigned char *buf = NULL;
+	long n;
+
+	if (!(fp = fopen(fname, "rb")))
+		return NULL;
+
+	/* skip the 16 byte header, the graph of version 0 follows directly */
+	if (fseek(fp, 0, SEEK_END) == 0 && (n = ftell(fp)) > 16 && (buf = malloc(n - 16))) {
+		fseek(fp, 16, SEEK_SET);
+		if (fread(buf, 1, n - 16, fp) != (size_t) (n - 16)) {
+			free(buf);
+			buf = NULL;
+		} else
+			*length = n - 16;
+	}
+
+	fclose(fp);
+	return buf;
+}
+
+int main(int argc, const char * const *argv)
+{
+	const char *fname = argc > 1 ? argv[1] : "hsts.dafsa";
+	unsigned char *graph;
+	size_t length, it, errors = 0, interpreter_errors = 0, found = 0;
+	int rounds = getenv("BENCH_ROUNDS") ? atoi(getenv("BENCH_ROUNDS")) : 10, round;
+	double start, interpreted, compiled;
+	volatile int sink = 0;
+
+	if (!(graph = load_dafsa(fname, &length))) {
+		fprintf(stderr, "Failed to load %s\n", fname);
+		return 1;
+	}
+
+	if (EnumerateFixedSet(graph, length, 0, collect, NULL) || !probes.nprobes) {
+		fprintf(stderr, "Failed to enumerate %s\n", fname);
+		return 1;
+	}
+
+	set_expected();
+
+	for (it = 0; it < probes.nprobes; it++) {
+		const struct probe *p = &probes.probe[it];
+
+		if (LookupStringInFixedSetCompiled(graph, length, p->key, p->length) != p->value) {
+			if (errors++ < 10)
+				fprintf(stderr, "Mismatch for '%s'\n", p->key);
+		}
+
+		if (LookupStringInFixedSet(graph, length, p->key, p->length) != p->value)
+			interpreter_errors++;
+
+		if (p->value >= 0)
+			found++;
+	}
+
+	printf("%zu keys checked (%zu found), %zu mismatches\n", probes.nprobes, found, errors);
+	if (interpreter_errors)
+		printf("interpreter: %zu mismatches (known issue with near misses of UTF-8 entries)\n", interpreter_errors);
+
+	start = now();
+	for (round = 0; round < rounds; round++)
+		for (it = 0; it < probes.nprobes; it++)
+			sink += LookupStringInFixedSet(graph, length, probes.probe[it].key, probes.probe[it].length);
+	interpreted = now() - start;
+
+	start = now();
+	for (round = 0; round < rounds; round++)
+		for (it = 0; it < probes.nprobes; it++)
+			sink += LookupStringInFixedSetCompiled(graph, length, probes.probe[it].key, probes.probe[it].length);
+	compiled = now() - start;
+
+	printf("interpreter: %6.1f ns/lookup, %zu bytes of data\n",
+		interpreted * 1e9 / ((double) probes.nprobes * rounds), length);
+	printf("compiled:    %6.1f ns/lookup\n",
+		compiled * 1e9 / ((double) probes.nprobes * rounds));
+
+	free_probes(&probes);
+	free_probes(&entries);
+	free(graph);
+
+	return errors ? 1 : 0;
+}
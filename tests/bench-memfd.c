@@ -0,0 +1,346 @@
+/*
+ * Copyright(c) 2018 Tim Ruehsen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * This file is part of the test suite of libhsts.
+ *
+ * A parent publishes updates of the HSTS data to prefork children, either as a
+ * sealed memfd (hsts_export_memfd() / hsts_import_fd()) sent over a unix socket,
+ * or by having each child load its own copy. Reports the update latency and the
+ * total RSS and PSS of the children.
+ * Not run by 'make check', build with 'make bench-memfd'.
+ *
+ * Example:
+ *   ./bench-memfd trace.txt hsts.dafsa 64 10
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include <libhsts.h>
+
+struct usage {
+	size_t
+		rss, /* kB */
+		pss;
+};
+
+static char **hosts;
+static size_t nhosts;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int load_trace(const char *fname)
+{
+	FILE *fp;
+	char buf[256], *host;
+	size_t len, size = 0;
+
+	if (!(fp = fopen(fname, "r")))
+		return -1;
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		for (host = buf; isspace(*host); host++);
+		if (*host == '#' || !*host) continue;
+		for (len = 0; host[len] && !isspace(host[len]); len++);
+		host[len] = 0;
+
+		if (nhosts >= size) {
+			char **tmp = realloc(hosts, (size = size ? size * 2 : 4096) * sizeof(char *));
+
+			if (!tmp)
+				break;
+			hosts = tmp;
+		}
+
+		if (!(hosts[nhosts] = strdup(host)))
+			break;
+		nhosts++;
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+/* sends one command byte, with fd >= 0 attached as SCM_RIGHTS */
+static int send_cmd(int sock, char cmd, int fd)
+{
+	struct msghdr msg;
+	struct iovec iov = { &cmd, 1 };
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} u;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (fd >= 0) {
+		struct cmsghdr *cmsg;
+
+		msg.msg_control = u.buf;
+		msg.msg_controllen = sizeof(u.buf);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	return sendmsg(sock, &msg, 0) == 1 ? 0 : -1;
+}
+
+/* receives one command byte and an attached fd (-1 if none), returns 0 on EOF */
+static char recv_cmd(int sock, int *fd)
+{
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	char cmd;
+	struct iovec iov = { &cmd, 1 };
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} u;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = u.buf;
+	msg.msg_controllen = sizeof(u.buf);
+
+	*fd = -1;
+
+	if (recvmsg(sock, &msg, 0) != 1)
+		return 0;
+
+	if ((cmsg = CMSG_FIRSTHDR(&msg)) && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+		memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+
+	return cmd;
+}
+
+static void get_usage(struct usage *usage)
+{
+	FILE *fp;
+	char buf[128];
+
+	usage->rss = usage->pss = 0;
+
+	if (!(fp = fopen("/proc/self/smaps_rollup", "r")))
+		return;
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		if (!strncmp(buf, "Rss:", 4))
+			usage->rss = (size_t) atol(buf + 4);
+		else if (!strncmp(buf, "Pss:", 4))
+			usage->pss = (size_t) atol(buf + 4);
+	}
+
+	fclose(fp);
+}
+
+/*
+ * 'u': load the update (memfd attached, or the file), reply 'u'
+ * 's': look up all hosts, touching the data like real traffic would, reply 's'
+ * 'm': reply with struct usage
+ */
+static int child(int sock, const char *fname)
+{
+	hsts_t *hsts = NULL, *update;
+	struct usage usage;
+	char cmd;
+	int fd, rc;
+	size_t it;
+
+	while ((cmd = recv_cmd(sock, &fd))) {
+		if (cmd == 'u') {
+			if (fd >= 0) {
+				rc = hsts_import_fd(fd, &update);
+				close(fd);
+			} else
+				rc = hsts_load_file(fname, &update);
+
+			if (rc != HSTS_SUCCESS)
+				return 1;
+
+			hsts_free(hsts);
+			hsts = update;
+
+			if (write(sock, &cmd, 1) != 1)
+				return 1;
+		} else if (cmd == 's') {
+			for (it = 0; it < nhosts; it++)
+				hsts_search(hsts, hosts[it], 0, NULL);
+
+			if (write(sock, &cmd, 1) != 1)
+				return 1;
+		} else if (cmd == 'm') {
+			get_usage(&usage);
+			if (write(sock, &usage, sizeof(usage)) != sizeof(usage))
+				return 1;
+		}
+	}
+
+	hsts_free(hsts);
+	return 0;
+}
+
+static int bench(const char *fname, int nchildren, int nupdates, int use_memfd)
+{
+	int *socks = calloc(nchildren, sizeof(int)), it, update, rc = 0;
+	struct usage usage, total = { 0, 0 };
+	double start, elapsed = 0;
+	char ack;
+
+	if (!socks)
+		return -1;
+
+	fflush(stdout);
+
+	for (it = 0; it < nchildren; it++) {
+		int sv[2];
+
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+			return -1;
+
+		if (fork() == 0) {
+			while (it--)
+				close(socks[it]);
+			close(sv[0]);
+			_exit(child(sv[1], fname));
+		}
+
+		close(sv[1]);
+		socks[it] = sv[0];
+	}
+
+	for (update = 0; update < nupdates && !rc; update++) {
+		hsts_t *hsts;
+		int fd = -1;
+
+		/* the parent's graph: in practice built or patched in memory */
+		if (hsts_load_file(fname, &hsts) != HSTS_SUCCESS)
+			return -1;
+
+		start = now();
+
+		if (use_memfd && hsts_export_memfd(hsts, &fd) != HSTS_SUCCESS) {
+			hsts_free(hsts);
+			return -1;
+		}
+
+		for (it = 0; it < nchildren && !rc; it++)
+			rc = send_cmd(socks[it], 'u', fd);
+		for (it = 0; it < nchildren && !rc; it++)
+			rc = read(socks[it], &ack, 1) == 1 ? 0 : -1;
+
+		elapsed += now() - start;
+
+		for (it = 0; it < nchildren && !rc; it++)
+			rc = send_cmd(socks[it], 's', -1) || read(socks[it], &ack, 1) != 1 ? -1 : 0;
+
+		if (fd >= 0)
+			close(fd);
+		hsts_free(hsts);
+	}
+
+	for (it = 0; it < nchildren && !rc; it++) {
+		if (send_cmd(socks[it], 'm', -1) || read(socks[it], &usage, sizeof(usage)) != sizeof(usage))
+			rc = -1;
+		total.rss += usage.rss;
+		total.pss += usage.pss;
+	}
+
+	for (it = 0; it < nchildren; it++)
+		close(socks[it]);
+	while (wait(NULL) > 0);
+	free(socks);
+
+	if (!rc)
+		printf("%-8s %d children: update %.2f ms, total RSS %zu kB, total PSS %zu kB\n",
+			use_memfd ? "memfd:" : "private:", nchildren, elapsed * 1000 / nupdates, total.rss, total.pss);
+
+	return rc;
+}
+
+int main(int argc, const char * const *argv)
+{
+	int nchildren = 64, nupdates = 10;
+	hsts_t *hsts;
+	int fd;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <trace file> <dafsa file> [children] [updates]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc > 3)
+		nchildren = atoi(argv[3]);
+	if (argc > 4)
+		nupdates = atoi(argv[4]);
+
+	if (load_trace(argv[1]) || !nhosts) {
+		fprintf(stderr, "Failed to read host names from %s\n", argv[1]);
+		return 1;
+	}
+
+	if (hsts_load_file(argv[2], &hsts) != HSTS_SUCCESS) {
+		fprintf(stderr, "Failed to load %s\n", argv[2]);
+		return 1;
+	}
+
+	if (hsts_export_memfd(hsts, &fd) != HSTS_SUCCESS) {
+		fprintf(stderr, "No sealed memfd support\n");
+		hsts_free(hsts);
+		return 1;
+	}
+
+	close(fd);
+	hsts_free(hsts);
+
+	if (nchildren < 1 || nupdates < 1 || bench(argv[2], nchildren, nupdates, 0) || bench(argv[2], nchildren, nupdates, 1)) {
+		fprintf(stderr, "Benchmark failed\n");
+		return 1;
+	}
+
+	while (nhosts)
+		free(hosts[--nhosts]);
+	free(hosts);
+
+	return 0;
+}
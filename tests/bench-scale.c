@@ -0,0 +1,413 @@
+/*
+ * Copyright(c) 2018 Tim Ruehsen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * This file is part of the test suite of libhsts.
+ *
+ * Load time, memory and lookup latency for millions of synthetic entries.
+ * Not run by 'make check', build with 'make bench-scale'.
+ *
+ * hsts-make-dafsa keeps the whole graph as Python objects and needs a few GB
+ * per million entries, so this benchmark writes its lists directly: a trie
+ * (suffixes are not joined) in format version 2 (wide offsets).
+ *
+ * Example:
+ *   ./bench-scale 10000000 /tmp/hsts_10m.dafsa
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#ifdef __GLIBC__
+#	include <malloc.h>
+#endif
+
+#include <libhsts.h>
+
+struct buffer {
+	unsigned char
+		*data;
+	size_t
+		len,
+		size;
+};
+
+static unsigned char **keys;
+static char *arena;
+static size_t nkeys;
+static struct buffer out;
+static uint64_t rnd_state = 88172645463325252ULL;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t heap_used(void)
+{
+#if defined __GLIBC__ && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	struct mallinfo2 mi = mallinfo2();
+
+	return mi.uordblks + mi.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+/* xorshift64 */
+static uint64_t rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 7;
+	rnd_state ^= rnd_state << 17;
+	return rnd_state;
+}
+
+static size_t rnd_label(char *p, int min, int max)
+{
+	int it, n = min + (int) (rnd() % (unsigned) (max - min + 1));
+
+	for (it = 0; it < n; it++)
+		p[it] = (char) ('a' + rnd() % 26);
+
+	return (size_t) n;
+}
+
+/* a random host name like the ones in tests/hsts.json: [sub.]label.tld */
+static size_t rnd_name(char *p)
+{
+	static const char *tlds[] = { "com", "org", "net", "gov", "io", "de", "uk", "app", "dev" };
+	const char *tld = tlds[rnd() % (sizeof(tlds) / sizeof(tlds[0]))];
+	size_t len = 0;
+
+	if (rnd() % 10 < 3) {
+		len += rnd_label(p, 2, 6);
+		p[len++] = '.';
+	}
+
+	len += rnd_label(p + len, 3, 12);
+	p[len++] = '.';
+	strcpy(p + len, tld);
+
+	return len + strlen(tld);
+}
+
+static int append(const unsigned char *p, size_t n)
+{
+	if (out.len + n > out.size) {
+		unsigned char *tmp = realloc(out.data, out.size = (out.size + n) * 2);
+
+		if (!tmp)
+			return -1;
+		out.data = tmp;
+	}
+
+	memcpy(out.data + out.len, p, n);
+	out.len += n;
+	return 0;
+}
+
+/*
+ * Appends the links to the children at |pos| (distance from the end of the graph,
+ * nearest child first), like encode_links() of hsts-make-dafsa.
+ * The graph is built back to front, so all bytes are appended in reverse order.
+ */
+static int emit_links(const size_t *pos, size_t n)
+{
+	unsigned char buf[5 * 256], rev[5 * 256];
+	size_t guess = 5 * n, len, last = 0, it;
+
+	for (;;) {
+		uint64_t offset = out.len + guess;
+
+		for (len = it = 0; it < n; it++) {
+			uint64_t distance = offset - pos[it];
+
+			last = len;
+			if (distance < (1 << 6)) {
+				buf[len++] = (unsigned char) distance;
+			} else if (distance < (1 << 13)) {
+				buf[len++] = (unsigned char) (0x40 | (distance >> 8));
+				buf[len++] = (unsigned char) distance;
+			} else if (distance < (1 << 20)) {
+				buf[len++] = (unsigned char) (0x60 | (distance >> 16));
+				buf[len++] = (unsigned char) (distance >> 8);
+				buf[len++] = (unsigned char) distance;
+			} else {
+				buf[len++] = (unsigned char) (0x70 | (distance >> 32));
+				buf[len++] = (unsigned char) (distance >> 24);
+				buf[len++] = (unsigned char) (distance >> 16);
+				buf[len++] = (unsigned char) (distance >> 8);
+				buf[len++] = (unsigned char) distance;
+			}
+			offset -= distance;
+		}
+
+		if (len == guess)
+			break;
+		guess = len;
+	}
+
+	buf[last] |= 0x80;
+	for (it = 0; it < len; it++)
+		rev[it] = buf[len - 1 - it];
+
+	return append(rev, len);
+}
+
+/*
+ * Emits the node for keys[lo..hi) that all share the byte at |depth| and returns
+ * its position (distance from the end of the graph), 0 if out of memory.
+ */
+static size_t emit_node(size_t lo, size_t hi, size_t depth)
+{
+	const unsigned char *first = keys[lo], *last = keys[hi - 1];
+	size_t pos[256], npos = 0, end = depth, it;
+
+	/* the label goes on as long as all keys share the next byte */
+	while (!(first[end] & 0x80) && first[end + 1] == last[end + 1])
+		end++;
+
+	if (!(first[end] & 0x80)) {
+		/* emit the children back to front, remember them nearest first */
+		size_t group_hi = hi, group_lo;
+		size_t children[256], nchildren = 0;
+
+		while (group_hi > lo) {
+			unsigned char c = keys[group_hi - 1][end + 1];
+
+			for (group_lo = group_hi - 1; group_lo > lo && keys[group_lo - 1][end + 1] == c; group_lo--);
+
+			if (!(children[nchildren++] = emit_node(group_lo, group_hi, end + 1)))
+				return 0;
+			group_hi = group_lo;
+		}
+
+		while (nchildren)
+			pos[npos++] = children[--nchildren];
+
+		if (emit_links(pos, npos))
+			return 0;
+	}
+
+	/* the label, the last char is marked as <end_char> unless it is the <return value> */
+	for (it = end + 1; it > depth; it--) {
+		unsigned char c = first[it - 1];
+
+		if (it - 1 == end && !(c & 0x80))
+			c |= 0x80;
+
+		if (append(&c, 1))
+			return 0;
+	}
+
+	return out.len;
+}
+
+static int compare_keys(const void *p1, const void *p2)
+{
+	return strcmp(*(char * const *) p1, *(char * const *) p2);
+}
+
+/* generates n entries, sorted and without duplicates */
+static int make_keys(size_t n)
+{
+	char buf[64];
+	size_t it, pos = 0, unique;
+
+	if (!(keys = malloc(n * sizeof(char *))) || !(arena = malloc(n * 27)))
+		return -1;
+
+	for (it = 0; it < n; it++) {
+		size_t len = rnd_name(buf);
+
+		keys[it] = (unsigned char *) arena + pos;
+		memcpy(arena + pos, buf, len);
+		arena[pos + len] = (char) (rnd() % 10 < 6 ? 0x81 : 0x80); /* include_subdomains */
+		arena[pos + len + 1] = 0;
+		pos += len + 2;
+	}
+
+	qsort(keys, n, sizeof(char *), compare_keys);
+
+	/* keep one entry per name */
+	for (unique = it = 0; it < n; it++) {
+		size_t len = strlen((char *) keys[it]) - 1;
+
+		if (unique && !strncmp((char *) keys[unique - 1], (char *) keys[it], len) && (keys[unique - 1][len] & 0x80))
+			continue;
+		keys[unique++] = keys[it];
+	}
+
+	nkeys = unique;
+	return 0;
+}
+
+static int write_dafsa(const char *fname)
+{
+	size_t pos[256], npos = 0, group_hi = nkeys, group_lo, it;
+	unsigned char tmp;
+	FILE *fp;
+	int rc;
+
+	/* source: links to the first bytes */
+	while (group_hi > 0) {
+		unsigned char c = keys[group_hi - 1][0];
+
+		for (group_lo = group_hi - 1; group_lo > 0 && keys[group_lo - 1][0] == c; group_lo--);
+
+		if (!(pos[npos++] = emit_node(group_lo, group_hi, 0)))
+			return -1;
+		group_hi = group_lo;
+	}
+
+	for (it = 0; it < npos / 2; it++) {
+		size_t t = pos[it];
+
+		pos[it] = pos[npos - 1 - it];
+		pos[npos - 1 - it] = t;
+	}
+
+	if (emit_links(pos, npos))
+		return -1;
+
+	for (it = 0; it < out.len / 2; it++) {
+		tmp = out.data[it];
+		out.data[it] = out.data[out.len - 1 - it];
+		out.data[out.len - 1 - it] = tmp;
+	}
+
+	tmp = 0x01; /* UTF-8 mode */
+	if (append(&tmp, 1))
+		return -1;
+
+	if (!(fp = fopen(fname, "wb")))
+		return -1;
+
+	rc = fwrite(".DAFSA@HSTS_2  \n", 1, 16, fp) != 16 || fwrite(out.data, 1, out.len, fp) != out.len;
+
+	return fclose(fp) || rc ? -1 : 0;
+}
+
+static double bench_lookups(const hsts_t *hsts, char **list, size_t n, size_t *found)
+{
+	double start = now();
+	size_t it;
+
+	for (*found = it = 0; it < n; it++) {
+		if (hsts_search(hsts, list[it], 0, NULL) == HSTS_SUCCESS)
+			(*found)++;
+	}
+
+	return n ? (now() - start) * 1e9 / n : 0;
+}
+
+int main(int argc, const char * const *argv)
+{
+	size_t n, nlookups = 1000000, it, mem, graph_size, found[3];
+	char **hits, **subdomains, **misses, buf[64];
+	double start, build_secs, load_secs, ns[3];
+	hsts_t *hsts;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <number of entries> <dafsa file to write> [number of lookups]\n", argv[0]);
+		return 1;
+	}
+
+	n = (size_t) atol(argv[1]);
+	if (argc > 3)
+		nlookups = (size_t) atol(argv[3]);
+
+	start = now();
+	if (!n || make_keys(n) || write_dafsa(argv[2])) {
+		fprintf(stderr, "Failed to build %s\n", argv[2]);
+		return 1;
+	}
+	build_secs = now() - start;
+	graph_size = out.len;
+
+	/* lookup samples: entries, subdomains of entries and random names */
+	hits = malloc(nlookups * sizeof(char *));
+	subdomains = malloc(nlookups * sizeof(char *));
+	misses = malloc(nlookups * sizeof(char *));
+	if (!hits || !subdomains || !misses)
+		return 1;
+
+	for (it = 0; it < nlookups; it++) {
+		const char *key = (const char *) keys[rnd() % nkeys];
+		size_t len = strlen(key) - 1;
+
+		hits[it] = malloc(len + 1);
+		subdomains[it] = malloc(len + 5);
+		buf[rnd_name(buf)] = 0;
+		misses[it] = strdup(buf);
+		if (!hits[it] || !subdomains[it] || !misses[it])
+			return 1;
+
+		memcpy(hits[it], key, len);
+		hits[it][len] = 0;
+		memcpy(subdomains[it], "www.", 4);
+		memcpy(subdomains[it] + 4, key, len);
+		subdomains[it][len + 4] = 0;
+	}
+
+	free(arena);
+	free(keys);
+	free(out.data);
+
+	mem = heap_used();
+	start = now();
+	if (hsts_load_file_limit(argv[2], (size_t) -1, &hsts) != HSTS_SUCCESS) {
+		fprintf(stderr, "Failed to load %s\n", argv[2]);
+		return 1;
+	}
+	load_secs = now() - start;
+	mem = heap_used() - mem;
+
+	ns[0] = bench_lookups(hsts, hits, nlookups, &found[0]);
+	ns[1] = bench_lookups(hsts, subdomains, nlookups, &found[1]);
+	ns[2] = bench_lookups(hsts, misses, nlookups, &found[2]);
+
+	printf("%zu entries: %zu bytes (%.1f/entry), build %.1f s, load %.3f s, heap %zu bytes\n",
+		nkeys, graph_size, (double) graph_size / nkeys, build_secs, load_secs, mem);
+	printf("%zu entries: hit %.1f ns (%zu/%zu), subdomain %.1f ns (%zu), random %.1f ns (%zu)\n",
+		nkeys, ns[0], found[0], nlookups, ns[1], found[1], ns[2], found[2]);
+
+	hsts_free(hsts);
+	for (it = 0; it < nlookups; it++) {
+		free(misses[it]);
+		free(subdomains[it]);
+		free(hits[it]);
+	}
+	free(misses);
+	free(subdomains);
+	free(hits);
+
+	return found[0] == nlookups ? 0 : 1;
+}
@@ -0,0 +1,203 @@
+/*
+ * Copyright(c) 2018 Tim Ruehsen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * This file is part of the test suite of libhsts.
+ *
+ * Load generator for 'hsts --serve'.
+ * Not run by 'make check', build with 'make bench-server'.
+ *
+ * Example:
+ *   hsts --load-hsts-file hsts.dafsa --serve /tmp/hsts.sock &
+ *   ./bench-server /tmp/hsts.sock trace.txt 1000 4 hsts.dafsa
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libhsts.h>
+#include "hsts-client.h"
+
+static const char **hosts;
+static size_t nhosts;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int load_trace(const char *fname)
+{
+	FILE *fp;
+	char buf[256], *host;
+	size_t len, size = 0;
+
+	if (!(fp = fopen(fname, "r")))
+		return -1;
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		for (host = buf; isspace(*host); host++);
+		if (*host == '#' || !*host) continue;
+		for (len = 0; host[len] && !isspace(host[len]); len++);
+		host[len] = 0;
+
+		if (nhosts >= size) {
+			const char **tmp = realloc(hosts, (size = size ? size * 2 : 4096) * sizeof(char *));
+
+			if (!tmp)
+				break;
+			hosts = tmp;
+		}
+
+		if (!(hosts[nhosts] = strdup(host)))
+			break;
+		nhosts++;
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+/* compare the server results with local lookups */
+static size_t verify(const char *fname, const unsigned char *results)
+{
+	hsts_t *hsts;
+	size_t it, errors = 0;
+
+	if (hsts_load_file(fname, &hsts) != HSTS_SUCCESS) {
+		fprintf(stderr, "Failed to load %s\n", fname);
+		return nhosts;
+	}
+
+	for (it = 0; it < nhosts; it++) {
+		hsts_entry_t *e;
+		unsigned char expected = 0;
+
+		if (hsts_search(hsts, hosts[it], 0, &e) == HSTS_SUCCESS) {
+			expected = HSTS_RESULT_FOUND | (hsts_has_include_subdomains(e) ? HSTS_RESULT_INCLUDE_SUBDOMAINS : 0);
+			hsts_free_entry(e);
+		}
+
+		if (results[it] != expected)
+			errors++;
+	}
+
+	hsts_free(hsts);
+	return errors;
+}
+
+int main(int argc, const char * const *argv)
+{
+	hsts_server_stats_t stats;
+	unsigned char *results;
+	size_t batch = 1000, depth = 4, sent = 0, received = 0;
+	double start, secs;
+	int fd;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <socket> <trace file> [batch size] [pipeline depth] [dafsa file to verify]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc > 3 && (batch = (size_t) atol(argv[3])) < 1)
+		batch = 1;
+	if (argc > 4 && (depth = (size_t) atol(argv[4])) < 1)
+		depth = 1;
+
+	if (load_trace(argv[2]) || !nhosts) {
+		fprintf(stderr, "Failed to read host names from %s\n", argv[2]);
+		return 1;
+	}
+
+	if ((fd = hsts_client_connect(argv[1])) < 0) {
+		fprintf(stderr, "Failed to connect to %s\n", argv[1]);
+		return 1;
+	}
+
+	if (!(results = malloc(nhosts))) {
+		close(fd);
+		return 1;
+	}
+
+	start = now();
+
+	/* keep up to 'depth' batches in flight */
+	while (received < nhosts) {
+		while (sent < nhosts && sent - received < batch * depth) {
+			size_t n = nhosts - sent < batch ? nhosts - sent : batch;
+
+			if (hsts_client_send_query(fd, hosts + sent, n)) {
+				fprintf(stderr, "Failed to send query\n");
+				return 1;
+			}
+			sent += n;
+		}
+
+		{
+			size_t n = nhosts - received < batch ? nhosts - received : batch;
+
+			if (hsts_client_recv_results(fd, results + received, n)) {
+				fprintf(stderr, "Failed to receive results\n");
+				return 1;
+			}
+			received += n;
+		}
+	}
+
+	secs = now() - start;
+
+	printf("%zu hosts in batches of %zu, pipeline depth %zu: %.3f s, %.0f hosts/s, %.1f us/batch round trip\n",
+		nhosts, batch, depth, secs, nhosts / secs, secs * 1e6 / ((nhosts + batch - 1) / batch));
+
+	if (hsts_client_stats(fd, &stats) == 0) {
+		printf("server: %llu queries, hit rate %.1f%%, %llu batches, %.1f ns/query busy\n",
+			(unsigned long long) stats.queries,
+			stats.queries ? stats.hits * 100.0 / stats.queries : 0.0,
+			(unsigned long long) stats.batches,
+			stats.queries ? (double) stats.busy_ns / stats.queries : 0.0);
+	}
+
+	if (argc > 5) {
+		size_t errors = verify(argv[5], results);
+
+		printf("verify: %zu mismatches\n", errors);
+		if (errors)
+			return 1;
+	}
+
+	close(fd);
+	free(results);
+	while (nhosts)
+		free((char *) hosts[--nhosts]);
+	free(hosts);
+
+	return 0;
+}
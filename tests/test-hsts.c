@@ -29,6 +29,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #ifdef HAVE_ALLOCA_H
 #	include <alloca.h>
 #endif
@@ -41,7 +43,7 @@ static int
 	ok,
 	failed;
 
-static void test_hsts(void)
+static void test_hsts_file(const char *fname)
 {
 	/* punycode generation: idn ?? */
 	/* octal code generation: echo -n "??" | od -b */
@@ -60,21 +62,34 @@ static void test_hsts(void)
 		{ "adfhoweirh.com", HSTS_ERR_NOT_FOUND, 0 }, /* unknown domain */
 		{ "at.search.yahoo.com", HSTS_SUCCESS, 0 }, /* exists, include_subdomains is FALSE */
 		{ "fan.gov", HSTS_SUCCESS, 1 }, /*exists, include_subdomains is TRUE */
+		{ "b\303\274cher.fan.gov", HSTS_SUCCESS, 1 }, /* non-ASCII subdomain */
+		{ "f\303\244n.gov", HSTS_ERR_NOT_FOUND, 0 }, /* non-ASCII domain */
 	};
-	unsigned it;
+	static const hsts_engine_t engines[] = { HSTS_ENGINE_DAFSA, HSTS_ENGINE_HASH };
+	unsigned it, engine;
 	int result;
 	hsts_t *hsts;
 
-	if (hsts_load_file(SRCDIR "/hsts.dafsa", &hsts) != HSTS_SUCCESS) {
+	if (hsts_load_file(fname, &hsts) != HSTS_SUCCESS) {
 		failed++;
-		printf("Failed to load %s/hsts.dafsa\n", SRCDIR);
+		printf("Failed to load %s\n", fname);
 		return;
 	}
 
+	for (engine = 0; engine < countof(engines); engine++)
 	for (it = 0; it < countof(test_data); it++) {
 		const struct test_data *t = &test_data[it];
 		hsts_entry_t *e;
 
+		if (it == 0) {
+			if ((result = hsts_set_engine(hsts, engines[engine])) == HSTS_SUCCESS) {
+				ok++;
+			} else {
+				failed++;
+				printf("hsts_set_engine(%d)=%d (expected %d)\n", (int) engines[engine], result, HSTS_SUCCESS);
+			}
+		}
+
 		result = hsts_search(hsts, t->domain, 0, &e);
 
 		if (result == t->result) {
@@ -106,12 +121,538 @@ static void test_hsts(void)
 		hsts_free_entry(e);
 	}
 
+	hsts_free(hsts);
+}
+
+static void test_hsts(void)
+{
+	test_hsts_file(SRCDIR "/hsts.dafsa");
+	test_hsts_file(SRCDIR "/hsts_ascii.dafsa"); /* ASCII-only lookup */
+	test_hsts_file(SRCDIR "/hsts_wide.dafsa"); /* wide offsets */
+
+	hsts_set_engine(NULL, HSTS_ENGINE_HASH);
 	hsts_get_version();
 	hsts_dist_filename();
 	hsts_load_file(NULL, NULL);
 	hsts_load_fp(NULL, NULL);
+}
 
-	hsts_free(hsts);
+static void test_hsts_load_limit(void)
+{
+	static const struct test_data {
+		size_t
+			max_size;
+		int
+			result;
+	} test_data[] = {
+		{ 0, HSTS_SUCCESS }, /* default limit */
+		{ 1000, HSTS_ERR_INPUT_TOO_LONG },
+		{ (size_t) -1, HSTS_SUCCESS },
+	};
+	unsigned it;
+
+	for (it = 0; it < countof(test_data); it++) {
+		const struct test_data *t = &test_data[it];
+		int result = hsts_load_file_limit(SRCDIR "/hsts.dafsa", t->max_size, NULL);
+
+		if (result == t->result) {
+			ok++;
+		} else {
+			failed++;
+			printf("hsts_load_file_limit(%zu)=%d (expected %d)\n", t->max_size, result, t->result);
+		}
+	}
+
+	hsts_load_file_limit(NULL, 0, NULL);
+	hsts_load_fp_limit(NULL, 0, NULL);
+}
+
+/* reads a whole file into a malloc'ed buffer */
+static char *read_file(const char *fname, size_t *size)
+{
+	FILE *fp;
+	char *buf = NULL;
+	long n;
+
+	if (!(fp = fopen(fname, "rb")))
+		return NULL;
+
+	if (fseek(fp, 0, SEEK_END) == 0 && (n = ftell(fp)) > 0 && (buf = malloc((size_t) n))) {
+		rewind(fp);
+		if (fread(buf, 1, (size_t) n, fp) == (size_t) n) {
+			*size = (size_t) n;
+		} else {
+			free(buf);
+			buf = NULL;
+		}
+	}
+
+	fclose(fp);
+	return buf;
+}
+
+static void test_hsts_auto_wide(void)
+{
+	char *auto_wide, *wide;
+	size_t auto_size = 0, wide_size = 0;
+	hsts_t *hsts;
+
+	/* built with a lowered narrow offset limit, hsts-make-dafsa had to switch to wide offsets */
+	auto_wide = read_file(SRCDIR "/hsts_auto_wide.dafsa", &auto_size);
+	wide = read_file(SRCDIR "/hsts_wide.dafsa", &wide_size);
+
+	if (auto_wide && auto_size > 16 && !memcmp(auto_wide, ".DAFSA@HSTS_3", 13)) {
+		ok++;
+	} else {
+		failed++;
+		printf("hsts_auto_wide.dafsa is not in format version 3\n");
+	}
+
+	if (auto_wide && wide && auto_size == wide_size && !memcmp(auto_wide, wide, wide_size)) {
+		ok++;
+	} else {
+		failed++;
+		printf("hsts_auto_wide.dafsa differs from hsts_wide.dafsa\n");
+	}
+
+	if (hsts_load_file(SRCDIR "/hsts_auto_wide.dafsa", &hsts) == HSTS_SUCCESS) {
+		if (hsts_search(hsts, "www.fan.gov", 0, NULL) == HSTS_SUCCESS) {
+			ok++;
+		} else {
+			failed++;
+			printf("hsts_search(www.fan.gov) failed on hsts_auto_wide.dafsa\n");
+		}
+		hsts_free(hsts);
+	} else {
+		failed++;
+		printf("Failed to load hsts_auto_wide.dafsa\n");
+	}
+
+	free(wide);
+	free(auto_wide);
+}
+
+static int strcmp_null(const char *s1, const char *s2)
+{
+	if (!s1 || !s2)
+		return s1 != s2;
+
+	return strcmp(s1, s2);
+}
+
+/*
+ * Calls |check| for each of |files| with each lookup engine.
+ * If |hit_counting| is set, hit counting is enabled before switching the engine.
+ */
+static void test_engines(const char *const *files, size_t nfiles, int hit_counting,
+	void (*check)(hsts_t *hsts, const char *fname))
+{
+	unsigned it, engine;
+	int result;
+
+	for (it = 0; it < nfiles; it++) {
+		for (engine = HSTS_ENGINE_DAFSA; engine <= HSTS_ENGINE_HASH; engine++) {
+			hsts_t *hsts;
+
+			if (hsts_load_file(files[it], &hsts) != HSTS_SUCCESS) {
+				failed++;
+				printf("Failed to load %s\n", files[it]);
+				continue;
+			}
+
+			result = hit_counting ? hsts_set_hit_counting(hsts, 1) : HSTS_SUCCESS;
+			if (result == HSTS_ERR_NOT_SUPPORTED) {
+				hsts_free(hsts);
+				return; /* no thread-local storage */
+			}
+
+			/* the hash table is shared by the engine and the hit counters */
+			if (result != HSTS_SUCCESS || hsts_set_engine(hsts, (hsts_engine_t) engine) != HSTS_SUCCESS) {
+				failed++;
+				printf("hsts_set_engine(%u) failed on %s\n", engine, files[it]);
+				hsts_free(hsts);
+				continue;
+			}
+
+			check(hsts, files[it]);
+			hsts_free(hsts);
+		}
+	}
+}
+
+static void check_records(hsts_t *hsts, const char *fname)
+{
+	static const struct test_data {
+		const char
+			*file,
+			*domain,
+			*mode,
+			*policy,
+			*pins,
+			*expect_ct_report_uri;
+		int
+			include_subdomains_result,
+			expect_ct_result;
+	} test_data[] = {
+		{ SRCDIR "/hsts_fixture.dafsa", "at.search.yahoo.com", "force-https", "custom", NULL, NULL, 0, 0 },
+		{ SRCDIR "/hsts_fixture.dafsa", "fan.gov", "force-https", "bulk-18-weeks", NULL, NULL, 1, 0 },
+		{ SRCDIR "/hsts_fixture.dafsa", "www.fan.gov", "force-https", "bulk-18-weeks", NULL, NULL, 1, 0 }, /* match via include_subdomains */
+		{ SRCDIR "/hsts_fixture.dafsa", "google.com", "force-https", "google", "google", NULL, 1, 0 },
+		{ SRCDIR "/hsts_fixture.dafsa", "youtube.com", "force-https", "google", "google", NULL, 0, 0 }, /* same record as google.com */
+		{ SRCDIR "/hsts_fixture.dafsa", "pinned.example", NULL, "custom", "tor", NULL, 0, 0 }, /* pinning only, no mode */
+		{ SRCDIR "/hsts_fixture.dafsa", "ct.example", "force-https", "custom", NULL, "https://report.example/ct", 0, 1 },
+		{ SRCDIR "/hsts_fixture.dafsa", "ct-only.example", NULL, "test", NULL, NULL, 0, 1 },
+		{ SRCDIR "/hsts_fixture.dafsa", "bulk.example", "force-https", "bulk-hsts", NULL, NULL, 1, 0 },
+		{ SRCDIR "/hsts.dafsa", "fan.gov", NULL, NULL, NULL, NULL, 1, 0 }, /* no records in format version 0 */
+		{ SRCDIR "/hsts_fixture_wide.dafsa", "at.search.yahoo.com", "force-https", "custom", NULL, NULL, 0, 0 }, /* format version 3 */
+		{ SRCDIR "/hsts_fixture_wide.dafsa", "www.fan.gov", "force-https", "bulk-18-weeks", NULL, NULL, 1, 0 },
+		{ SRCDIR "/hsts_fixture_wide.dafsa", "google.com", "force-https", "google", "google", NULL, 1, 0 },
+		{ SRCDIR "/hsts_fixture_wide.dafsa", "ct.example", "force-https", "custom", NULL, "https://report.example/ct", 0, 1 },
+	};
+	unsigned it;
+
+	for (it = 0; it < countof(test_data); it++) {
+		const struct test_data *t = &test_data[it];
+		hsts_entry_t *e;
+
+		if (strcmp(t->file, fname))
+			continue;
+
+		if (hsts_search(hsts, t->domain, 0, &e) != HSTS_SUCCESS) {
+			failed++;
+			printf("hsts_search(%s) failed on %s\n", t->domain, t->file);
+			continue;
+		}
+
+		if (!strcmp_null(hsts_get_mode(e), t->mode)
+			&& !strcmp_null(hsts_get_policy(e), t->policy)
+			&& !strcmp_null(hsts_get_pinset(e), t->pins)
+			&& !strcmp_null(hsts_get_expect_ct_report_uri(e), t->expect_ct_report_uri))
+		{
+			ok++;
+		} else {
+			failed++;
+			printf("record of %s is %s/%s/%s/%s (expected %s/%s/%s/%s) on %s\n", t->domain,
+				hsts_get_mode(e), hsts_get_policy(e), hsts_get_pinset(e), hsts_get_expect_ct_report_uri(e),
+				t->mode, t->policy, t->pins, t->expect_ct_report_uri, t->file);
+		}
+
+		if (hsts_has_expect_ct(e) == t->expect_ct_result) {
+			ok++;
+		} else {
+			failed++;
+			printf("hsts_has_expect_ct(%s)=%d (expected %d) on %s\n", t->domain, hsts_has_expect_ct(e), t->expect_ct_result, t->file);
+		}
+
+		if (hsts_has_include_subdomains(e) == t->include_subdomains_result) {
+			ok++;
+		} else {
+			failed++;
+			printf("hsts_has_include_subdomains(%s)=%d (expected %d) on %s\n", t->domain, hsts_has_include_subdomains(e), t->include_subdomains_result, t->file);
+		}
+
+		hsts_free_entry(e);
+	}
+}
+
+static void test_hsts_records(void)
+{
+	static const char *files[] = {
+		SRCDIR "/hsts_fixture.dafsa", SRCDIR "/hsts.dafsa", SRCDIR "/hsts_fixture_wide.dafsa",
+	};
+
+	test_engines(files, countof(files), 0, check_records);
+
+	hsts_get_mode(NULL);
+	hsts_get_policy(NULL);
+	hsts_get_pinset(NULL);
+	hsts_has_expect_ct(NULL);
+	hsts_get_expect_ct_report_uri(NULL);
+}
+
+static void test_hsts_analyze(void)
+{
+	static const char *files[] = { SRCDIR "/hsts.dafsa", SRCDIR "/hsts_records.dafsa", SRCDIR "/hsts_wide.dafsa" };
+	/* www.at.search.yahoo.com is no match: at.search.yahoo.com has no 'include_subdomains' */
+	static const char *hosts[] = { "fan.gov", "www.fan.gov", "www.at.search.yahoo.com", "adfhoweirh.com" };
+	char buf[4096];
+	unsigned it;
+
+	for (it = 0; it < countof(files); it++) {
+		hsts_t *hsts;
+		FILE *fp;
+		size_t n;
+		int result;
+
+		if (hsts_load_file(files[it], &hsts) != HSTS_SUCCESS) {
+			failed++;
+			printf("Failed to load %s\n", files[it]);
+			continue;
+		}
+
+		if (!(fp = tmpfile())) {
+			hsts_free(hsts);
+			continue;
+		}
+
+		if ((result = hsts_analyze(hsts, hosts, countof(hosts), fp)) == HSTS_SUCCESS) {
+			ok++;
+		} else {
+			failed++;
+			printf("hsts_analyze()=%d (expected %d) on %s\n", result, HSTS_SUCCESS, files[it]);
+		}
+
+		rewind(fp);
+		n = fread(buf, 1, sizeof(buf) - 1, fp);
+		buf[n] = 0;
+
+		if (strstr(buf, "\"entries\": ") && strstr(buf, "\"hosts\": 4, \"matched\": 2,")) {
+			ok++;
+		} else {
+			failed++;
+			printf("Unexpected hsts_analyze() output on %s:\n%s\n", files[it], buf);
+		}
+
+		fclose(fp);
+		hsts_free(hsts);
+	}
+
+	hsts_analyze(NULL, NULL, 0, stdout);
+}
+
+static void check_cursor(hsts_t *hsts, const char *fname)
+{
+	/* mostly in reversed-domain order, with some jumps */
+	static const char *domains[] = {
+		"gov", "fan.gov", "b\303\274cher.fan.gov", "www.fan.gov", "x.www.fan.gov", "x.www.fan.gov", "f\303\244n.gov",
+		"com", "yahoo.com", "search.yahoo.com", "at.search.yahoo.com", "x.at.search.yahoo.com", "search.yahoo.com",
+		"adfhoweirh.com", ".fan.gov", "", ".", "www.fan.gov", "fan.gov.", "gov.",
+		"..at.search.yahoo.com", "..fan.gov", "..www.fan.gov", /* only one leading dot is stripped */
+	};
+	hsts_cursor_t *cursor;
+	unsigned n;
+
+	if (hsts_cursor_new(hsts, &cursor) != HSTS_SUCCESS) {
+		failed++;
+		printf("Failed to set up cursor for %s\n", fname);
+		return;
+	}
+
+	for (n = 0; n < countof(domains); n++) {
+		hsts_entry_t *e1 = NULL, *e2 = NULL;
+		int result1 = hsts_search(hsts, domains[n], 0, &e1);
+		int result2 = hsts_cursor_search(cursor, domains[n], 0, &e2);
+
+		if (result1 == result2
+			&& hsts_has_include_subdomains(e1) == hsts_has_include_subdomains(e2)
+			&& hsts_get_mode(e1) == hsts_get_mode(e2))
+		{
+			ok++;
+		} else {
+			failed++;
+			printf("hsts_cursor_search(%s)=%d (expected %d) on %s\n", domains[n], result2, result1, fname);
+		}
+
+		hsts_free_entry(e2);
+		hsts_free_entry(e1);
+	}
+
+	hsts_cursor_free(cursor);
+}
+
+static void test_hsts_cursor(void)
+{
+	static const char *files[] = { SRCDIR "/hsts.dafsa", SRCDIR "/hsts_ascii.dafsa", SRCDIR "/hsts_records.dafsa" };
+
+	test_engines(files, countof(files), 0, check_cursor);
+
+	hsts_cursor_new(NULL, NULL);
+	hsts_cursor_search(NULL, NULL, 0, NULL);
+	hsts_cursor_free(NULL);
+}
+
+static void test_hsts_memfd(void)
+{
+	static const char *files[] = { SRCDIR "/hsts.dafsa", SRCDIR "/hsts_records.dafsa", SRCDIR "/hsts_wide.dafsa" };
+	static const char *domains[] = {
+		"fan.gov", "b\303\274cher.fan.gov", "f\303\244n.gov", "at.search.yahoo.com", "adfhoweirh.com", "",
+	};
+	unsigned it, n;
+	int fd, result;
+
+	for (it = 0; it < countof(files); it++) {
+		hsts_t *hsts, *imported;
+
+		if (hsts_load_file(files[it], &hsts) != HSTS_SUCCESS) {
+			failed++;
+			printf("Failed to load %s\n", files[it]);
+			continue;
+		}
+
+		if ((result = hsts_export_memfd(hsts, &fd)) == HSTS_ERR_NOT_SUPPORTED) {
+			hsts_free(hsts);
+			return; /* no memfd on this system */
+		}
+
+		if (result != HSTS_SUCCESS) {
+			failed++;
+			printf("hsts_export_memfd()=%d on %s\n", result, files[it]);
+			hsts_free(hsts);
+			continue;
+		}
+
+		/* sealed against writes */
+		if (write(fd, "x", 1) == -1) {
+			ok++;
+		} else {
+			failed++;
+			printf("memfd of %s is writable\n", files[it]);
+		}
+
+		result = hsts_import_fd(fd, &imported);
+		close(fd);
+
+		if (result != HSTS_SUCCESS || hsts_set_engine(imported, HSTS_ENGINE_HASH) != HSTS_SUCCESS) {
+			failed++;
+			printf("hsts_import_fd()=%d on %s\n", result, files[it]);
+			hsts_free(hsts);
+			continue;
+		}
+
+		for (n = 0; n < countof(domains); n++) {
+			hsts_entry_t *e1 = NULL, *e2 = NULL;
+			int result1 = hsts_search(hsts, domains[n], 0, &e1);
+			int result2 = hsts_search(imported, domains[n], 0, &e2);
+
+			if (result1 == result2
+				&& hsts_has_include_subdomains(e1) == hsts_has_include_subdomains(e2)
+				&& (hsts_get_mode(e1) == NULL) == (hsts_get_mode(e2) == NULL)
+				&& (!hsts_get_mode(e1) || !strcmp(hsts_get_mode(e1), hsts_get_mode(e2))))
+			{
+				ok++;
+			} else {
+				failed++;
+				printf("hsts_search(%s)=%d on the import of %s (expected %d)\n", domains[n], result2, files[it], result1);
+			}
+
+			hsts_free_entry(e2);
+			hsts_free_entry(e1);
+		}
+
+		hsts_free(imported);
+		hsts_free(hsts);
+	}
+
+	/* a regular file is not sealed */
+	if ((fd = open(SRCDIR "/hsts.dafsa", O_RDONLY)) != -1) {
+		if ((result = hsts_import_fd(fd, NULL)) == HSTS_ERR_INVALID_ARG) {
+			ok++;
+		} else {
+			failed++;
+			printf("hsts_import_fd(unsealed)=%d (expected %d)\n", result, HSTS_ERR_INVALID_ARG);
+		}
+		close(fd);
+	}
+
+	hsts_export_memfd(NULL, NULL);
+	hsts_import_fd(-1, NULL);
+}
+
+static void check_hits(hsts_t *hsts, const char *fname)
+{
+	static const char *domains[] = {
+		"fan.gov", "b\303\274cher.fan.gov", "at.search.yahoo.com", "fan.gov", "adfhoweirh.com", "at.search.yahoo.com", "fan.gov",
+	};
+	static const struct test_data {
+		size_t
+			n,
+			ntop;
+		unsigned long long
+			fan_hits; /* hits of the first entry, 'fan.gov' */
+	} test_data[] = {
+		{ 10, 2, 5 }, /* 'fan.gov' (includes 'www.fan.gov' of the cursor), 'at.search.yahoo.com' */
+		{ 1, 1, 5 },
+		{ 0, 0, 0 },
+	};
+	hsts_cursor_t *cursor;
+	hsts_hit_t *top = NULL;
+	size_t ntop;
+	unsigned n;
+	int result;
+
+	if (hsts_cursor_new(hsts, &cursor) != HSTS_SUCCESS) {
+		failed++;
+		printf("Failed to set up cursor for %s\n", fname);
+		return;
+	}
+
+	if ((result = hsts_top_entries(hsts, 10, &top, &ntop)) == HSTS_SUCCESS && ntop == 0) {
+		ok++;
+	} else {
+		failed++;
+		printf("Unexpected hits before any search on %s\n", fname);
+	}
+	if (result == HSTS_SUCCESS)
+		hsts_free_top_entries(top);
+
+	for (n = 0; n < countof(domains); n++)
+		hsts_search(hsts, domains[n], 0, NULL);
+	hsts_cursor_search(cursor, "www.fan.gov", 0, NULL);
+	hsts_cursor_free(cursor);
+
+	for (n = 0; n < countof(test_data); n++) {
+		const struct test_data *t = &test_data[n];
+
+		if ((result = hsts_top_entries(hsts, t->n, &top, &ntop)) != HSTS_SUCCESS) {
+			failed++;
+			printf("hsts_top_entries(%zu)=%d on %s\n", t->n, result, fname);
+			continue;
+		}
+
+		if (ntop == t->ntop && (!ntop || (!strcmp(top[0].domain, "fan.gov") && top[0].hits == t->fan_hits))
+			&& (ntop < 2 || (!strcmp(top[1].domain, "at.search.yahoo.com") && top[1].hits == 2)))
+		{
+			ok++;
+		} else {
+			failed++;
+			printf("hsts_top_entries(%zu) returned %zu entries (expected %zu) on %s\n", t->n, ntop, t->ntop, fname);
+			if (ntop)
+				printf("  first entry %s with %llu hits\n", top[0].domain, top[0].hits);
+		}
+
+		hsts_free_top_entries(top);
+	}
+
+	/* the counters survive switching the engine */
+	hsts_set_engine(hsts, HSTS_ENGINE_DAFSA);
+	hsts_search(hsts, "fan.gov", 0, NULL);
+	if ((result = hsts_top_entries(hsts, 1, &top, &ntop)) == HSTS_SUCCESS && ntop == 1 && top[0].hits == 6) {
+		ok++;
+	} else {
+		failed++;
+		printf("Lost hits after switching the engine on %s\n", fname);
+	}
+	if (result == HSTS_SUCCESS)
+		hsts_free_top_entries(top);
+
+	hsts_set_hit_counting(hsts, 0);
+	if ((result = hsts_top_entries(hsts, 1, &top, &ntop)) == HSTS_ERR_INVALID_ARG) {
+		ok++;
+	} else {
+		failed++;
+		printf("hsts_top_entries()=%d after disabling hit counting (expected %d)\n", result, HSTS_ERR_INVALID_ARG);
+	}
+}
+
+static void test_hsts_hits(void)
+{
+	static const char *files[] = { SRCDIR "/hsts.dafsa", SRCDIR "/hsts_records.dafsa", SRCDIR "/hsts_wide.dafsa" };
+
+	test_engines(files, countof(files), 1, check_hits);
+
+	hsts_set_hit_counting(NULL, 1);
+	hsts_top_entries(NULL, 1, NULL, NULL);
+	hsts_free_top_entries(NULL);
 }
 
 int main(int argc, const char * const *argv)
@@ -130,6 +671,13 @@ int main(int argc, const char * const *argv)
 	}
 
 	test_hsts();
+	test_hsts_load_limit();
+	test_hsts_auto_wide();
+	test_hsts_records();
+	test_hsts_analyze();
+	test_hsts_cursor();
+	test_hsts_memfd();
+	test_hsts_hits();
 
 	if (failed) {
 		printf("Summary: %d out of %d tests failed\n", failed, ok + failed);
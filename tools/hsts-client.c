@@ -0,0 +1,205 @@
+/*
+ * Copyright(c) 2018 Tim Ruehsen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * This file is part of libhsts.
+ *
+ * Client helper for 'hsts --serve', see hsts-client.h for the protocol
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "hsts-client.h"
+
+static int write_all(int fd, const unsigned char *buf, size_t len)
+{
+	while (len) {
+		/* MSG_NOSIGNAL: a daemon going away must not kill the caller with SIGPIPE */
+		ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		buf += n;
+		len -= (size_t) n;
+	}
+
+	return 0;
+}
+
+static int read_all(int fd, unsigned char *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = read(fd, buf, len);
+
+		if (n <= 0) {
+			if (n < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		buf += n;
+		len -= (size_t) n;
+	}
+
+	return 0;
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char) (v >> 24);
+	p[1] = (unsigned char) (v >> 16);
+	p[2] = (unsigned char) (v >> 8);
+	p[3] = (unsigned char) v;
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static uint64_t get64(const unsigned char *p)
+{
+	return ((uint64_t) get32(p) << 32) | get32(p + 4);
+}
+
+/* reads a frame header and checks type and length */
+static int read_header(int fd, int type, uint32_t length)
+{
+	unsigned char buf[5];
+
+	if (read_all(fd, buf, sizeof(buf)))
+		return -1;
+
+	if (buf[4] != type || get32(buf) != length)
+		return -1;
+
+	return 0;
+}
+
+int hsts_client_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int hsts_client_send_query(int fd, const char *const *hosts, size_t nhosts)
+{
+	unsigned char *buf, *p;
+	size_t it, size = 9;
+	int rc;
+
+	for (it = 0; it < nhosts; it++) {
+		size_t len = strlen(hosts[it]);
+
+		if (len > 255)
+			return -1;
+		size += 1 + len;
+	}
+
+	if (size - 4 > HSTS_PROTO_MAX_FRAME || !(buf = malloc(size)))
+		return -1;
+
+	put32(buf, (uint32_t) (size - 4));
+	buf[4] = HSTS_PROTO_QUERY;
+	put32(buf + 5, (uint32_t) nhosts);
+
+	for (p = buf + 9, it = 0; it < nhosts; it++) {
+		size_t len = strlen(hosts[it]);
+
+		*p++ = (unsigned char) len;
+		memcpy(p, hosts[it], len);
+		p += len;
+	}
+
+	rc = write_all(fd, buf, size);
+	free(buf);
+
+	return rc;
+}
+
+int hsts_client_recv_results(int fd, unsigned char *results, size_t nhosts)
+{
+	unsigned char buf[4];
+
+	if (read_header(fd, HSTS_PROTO_RESULTS, (uint32_t) (5 + nhosts)))
+		return -1;
+
+	if (read_all(fd, buf, sizeof(buf)) || get32(buf) != nhosts)
+		return -1;
+
+	return read_all(fd, results, nhosts);
+}
+
+int hsts_client_query(int fd, const char *const *hosts, size_t nhosts, unsigned char *results)
+{
+	if (hsts_client_send_query(fd, hosts, nhosts))
+		return -1;
+
+	return hsts_client_recv_results(fd, results, nhosts);
+}
+
+int hsts_client_stats(int fd, hsts_server_stats_t *stats)
+{
+	unsigned char buf[32] = { 0, 0, 0, 1, HSTS_PROTO_STATS };
+
+	if (write_all(fd, buf, 5))
+		return -1;
+
+	if (read_header(fd, HSTS_PROTO_STATS_REPLY, 33) || read_all(fd, buf, 32))
+		return -1;
+
+	stats->queries = get64(buf);
+	stats->hits = get64(buf + 8);
+	stats->batches = get64(buf + 16);
+	stats->busy_ns = get64(buf + 24);
+
+	return 0;
+}
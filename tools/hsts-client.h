@@ -0,0 +1,82 @@
+/*
+ * Copyright(c) 2018 Tim Ruehsen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * This file is part of libhsts.
+ *
+ * Protocol definitions and client helper for 'hsts --serve'
+ *
+ * All integers are big endian. Each message is a frame:
+ *
+ *   <uint32 length of type + payload> <uint8 type> <payload>
+ *
+ * Requests:
+ *   'Q' <uint32 count> (<uint8 length> <host>){count}  query a batch of hosts
+ *   'S'                                                request statistics
+ *
+ * Responses, in order of the requests:
+ *   'R' <uint32 count> <uint8 result>{count}           HSTS_RESULT_* bits per host
+ *   'T' <uint64 queries> <uint64 hits> <uint64 batches> <uint64 busy nanoseconds>
+ *
+ * A client may send any number of requests before reading the responses (pipelining).
+ * On a malformed request the server closes the connection.
+ */
+
+#ifndef HSTS_CLIENT_H
+#define HSTS_CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HSTS_PROTO_QUERY 'Q'
+#define HSTS_PROTO_RESULTS 'R'
+#define HSTS_PROTO_STATS 'S'
+#define HSTS_PROTO_STATS_REPLY 'T'
+
+/* max. frame length (excluding the length field) */
+#define HSTS_PROTO_MAX_FRAME (16 * 1024 * 1024)
+
+#define HSTS_RESULT_FOUND (1<<0)
+#define HSTS_RESULT_INCLUDE_SUBDOMAINS (1<<1)
+
+typedef struct {
+	uint64_t
+		queries,
+		hits,
+		batches,
+		busy_ns;
+} hsts_server_stats_t;
+
+/* connects to the unix socket at path, returns a file descriptor or -1 */
+int hsts_client_connect(const char *path);
+
+/* sends one query batch, returns 0 on success */
+int hsts_client_send_query(int fd, const char *const *hosts, size_t nhosts);
+
+/* receives the results of one query batch, returns 0 on success */
+int hsts_client_recv_results(int fd, unsigned char *results, size_t nhosts);
+
+/* sends a query batch and waits for the results */
+int hsts_client_query(int fd, const char *const *hosts, size_t nhosts, unsigned char *results);
+
+/* requests and receives the server statistics */
+int hsts_client_stats(int fd, hsts_server_stats_t *stats);
+
+#endif /* HSTS_CLIENT_H */
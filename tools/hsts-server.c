@@ -0,0 +1,488 @@
+/*
+ * Copyright(c) 2018 Tim Ruehsen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * This file is part of libhsts.
+ *
+ * Lookup daemon for 'hsts --serve', see hsts-client.h for the protocol
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libhsts.h>
+
+/* prototype to skip warning with -Wmissing-prototypes */
+int hsts_serve(const hsts_t *hsts, const char *path);
+
+#ifdef HAVE_SYS_EPOLL_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+#include "hsts-client.h"
+
+/* stop reading from a connection while this much output is pending */
+#define MAX_PENDING_OUTPUT (1024 * 1024)
+
+typedef struct {
+	unsigned char
+		*in,
+		*out;
+	size_t
+		in_len,
+		in_size,
+		out_pos,
+		out_len,
+		out_size;
+	int
+		fd,
+		events;
+	unsigned
+		eof : 1; /* peer has finished sending */
+} connection_t;
+
+static hsts_server_stats_t stats;
+static volatile sig_atomic_t terminate;
+
+static void on_signal(int sig)
+{
+	(void) sig;
+	terminate = 1;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char) (v >> 24);
+	p[1] = (unsigned char) (v >> 16);
+	p[2] = (unsigned char) (v >> 8);
+	p[3] = (unsigned char) v;
+}
+
+static void put64(unsigned char *p, uint64_t v)
+{
+	put32(p, (uint32_t) (v >> 32));
+	put32(p + 4, (uint32_t) v);
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+/* returns a pointer to len bytes of free output space */
+static unsigned char *reserve_output(connection_t *conn, size_t len)
+{
+	if (conn->out_len + len > conn->out_size) {
+		size_t size = conn->out_size ? conn->out_size : 4096;
+		unsigned char *p;
+
+		while (size < conn->out_len + len)
+			size *= 2;
+
+		if (!(p = realloc(conn->out, size)))
+			return NULL;
+
+		conn->out = p;
+		conn->out_size = size;
+	}
+
+	conn->out_len += len;
+	return conn->out + conn->out_len - len;
+}
+
+static int process_query(const hsts_t *hsts, connection_t *conn, const unsigned char *p, size_t len)
+{
+	const unsigned char *end = p + len;
+	unsigned char *out;
+	uint32_t count, it;
+	uint64_t start = now_ns();
+	char host[256];
+
+	if (len < 4)
+		return -1;
+
+	count = get32(p);
+	p += 4;
+
+	/* each host needs at least one byte */
+	if (count > len - 4 || !(out = reserve_output(conn, 9 + (size_t) count)))
+		return -1;
+
+	put32(out, 5 + count);
+	out[4] = HSTS_PROTO_RESULTS;
+	put32(out + 5, count);
+	out += 9;
+
+	for (it = 0; it < count; it++) {
+		hsts_entry_t *e;
+		size_t host_len;
+
+		if (p >= end || (host_len = *p) >= (size_t) (end - p))
+			return -1;
+
+		p++;
+		memcpy(host, p, host_len);
+		host[host_len] = 0;
+		p += host_len;
+
+		if (hsts_search(hsts, host, 0, &e) == HSTS_SUCCESS) {
+			out[it] = HSTS_RESULT_FOUND | (hsts_has_include_subdomains(e) ? HSTS_RESULT_INCLUDE_SUBDOMAINS : 0);
+			hsts_free_entry(e);
+			stats.hits++;
+		} else
+			out[it] = 0;
+	}
+
+	stats.queries += count;
+	stats.batches++;
+	stats.busy_ns += now_ns() - start;
+
+	return p == end ? 0 : -1;
+}
+
+static int process_stats(connection_t *conn)
+{
+	unsigned char *out;
+
+	if (!(out = reserve_output(conn, 37)))
+		return -1;
+
+	put32(out, 33);
+	out[4] = HSTS_PROTO_STATS_REPLY;
+	put64(out + 5, stats.queries);
+	put64(out + 13, stats.hits);
+	put64(out + 21, stats.batches);
+	put64(out + 29, stats.busy_ns);
+
+	return 0;
+}
+
+/* returns whether the input buffer starts with a complete frame */
+static int has_frame(const connection_t *conn)
+{
+	return conn->in_len >= 5 && conn->in_len - 4 >= get32(conn->in);
+}
+
+/* processes all complete frames in the input buffer */
+static int process_input(const hsts_t *hsts, connection_t *conn)
+{
+	size_t pos = 0;
+	int rc = 0;
+
+	while (conn->in_len - pos >= 5 && conn->out_len - conn->out_pos < MAX_PENDING_OUTPUT) {
+		const unsigned char *frame = conn->in + pos;
+		uint32_t len = get32(frame);
+
+		if (len < 1 || len > HSTS_PROTO_MAX_FRAME) {
+			rc = -1;
+			break;
+		}
+
+		if (conn->in_len - pos - 4 < len)
+			break; /* incomplete */
+
+		if (frame[4] == HSTS_PROTO_QUERY)
+			rc = process_query(hsts, conn, frame + 5, len - 1);
+		else if (frame[4] == HSTS_PROTO_STATS && len == 1)
+			rc = process_stats(conn);
+		else
+			rc = -1;
+
+		if (rc)
+			break;
+
+		pos += 4 + len;
+	}
+
+	memmove(conn->in, conn->in + pos, conn->in_len - pos);
+	conn->in_len -= pos;
+
+	return rc;
+}
+
+static int flush_output(connection_t *conn)
+{
+	while (conn->out_pos < conn->out_len) {
+		ssize_t n = send(conn->fd, conn->out + conn->out_pos, conn->out_len - conn->out_pos, MSG_NOSIGNAL);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+
+		conn->out_pos += (size_t) n;
+	}
+
+	conn->out_pos = conn->out_len = 0;
+	return 0;
+}
+
+static int read_input(connection_t *conn)
+{
+	for (;;) {
+		ssize_t n;
+
+		if (conn->in_size - conn->in_len < 4096) {
+			unsigned char *p;
+
+			if (conn->in_size >= 4 + HSTS_PROTO_MAX_FRAME + 4096)
+				return 0; /* buffer full, process first */
+
+			if (!(p = realloc(conn->in, conn->in_size = conn->in_size ? conn->in_size * 2 : 65536)))
+				return -1;
+
+			conn->in = p;
+		}
+
+		if ((n = read(conn->fd, conn->in + conn->in_len, conn->in_size - conn->in_len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+
+		if (n == 0)
+			return -1; /* closed by peer */
+
+		conn->in_len += (size_t) n;
+	}
+}
+
+static void close_connection(connection_t *conn)
+{
+	close(conn->fd);
+	free(conn->in);
+	free(conn->out);
+	free(conn);
+}
+
+/* wait for input unless too much output is pending, wait for output if any is pending */
+static int update_events(int epfd, connection_t *conn)
+{
+	struct epoll_event ev;
+	int events = 0;
+
+	if (!conn->eof && conn->out_len - conn->out_pos < MAX_PENDING_OUTPUT)
+		events |= EPOLLIN;
+	if (conn->out_pos < conn->out_len)
+		events |= EPOLLOUT;
+
+	if (events == conn->events)
+		return 0;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = (uint32_t) events;
+	ev.data.ptr = conn;
+	conn->events = events;
+
+	return epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+static void handle_connection(const hsts_t *hsts, int epfd, connection_t *conn, uint32_t events)
+{
+	if ((events & EPOLLERR) || ((events & EPOLLHUP) && !(events & EPOLLIN)))
+		goto close;
+
+	if ((events & EPOLLOUT) && flush_output(conn))
+		goto close;
+
+	if ((events & EPOLLIN) && read_input(conn))
+		conn->eof = 1;
+
+	/* also processes input that was held back by output backpressure */
+	do {
+		if (process_input(hsts, conn) || flush_output(conn))
+			goto close;
+	} while (!conn->out_len && has_frame(conn));
+
+	/* all requests of a finished peer have been answered */
+	if (conn->eof && !conn->out_len && !has_frame(conn))
+		goto close;
+
+	if (update_events(epfd, conn))
+		goto close;
+
+	return;
+
+close:
+	epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close_connection(conn);
+}
+
+static void accept_connections(int epfd, int listen_fd)
+{
+	int fd;
+
+	while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+		struct epoll_event ev;
+		connection_t *conn;
+
+		if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) || !(conn = calloc(1, sizeof(connection_t)))) {
+			close(fd);
+			continue;
+		}
+
+		conn->fd = fd;
+		conn->events = EPOLLIN;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = conn;
+
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+			close_connection(conn);
+	}
+}
+
+/*
+ * Serves lookups on the unix socket \p path until SIGINT or SIGTERM is received.
+ * Returns 0 on success or -1 on failure.
+ */
+int hsts_serve(const hsts_t *hsts, const char *path)
+{
+	struct sockaddr_un addr;
+	struct epoll_event ev, events[64];
+	struct sigaction sa;
+	struct stat st;
+	int listen_fd, epfd = -1, rc = -1, bound = 0;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return -1;
+	}
+
+	/* only replace a stale socket, never a regular file or anything else */
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			fprintf(stderr, "%s exists and is not a socket\n", path);
+			return -1;
+		}
+		if (unlink(path)) {
+			fprintf(stderr, "Failed to remove stale socket %s: %s\n", path, strerror(errno));
+			return -1;
+		}
+	} else if (errno != ENOENT) {
+		fprintf(stderr, "Failed to stat %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr))) {
+		fprintf(stderr, "Failed to bind to %s: %s\n", path, strerror(errno));
+		goto out;
+	}
+	bound = 1;
+
+	if (listen(listen_fd, SOMAXCONN) || fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK)) {
+		fprintf(stderr, "Failed to listen on %s: %s\n", path, strerror(errno));
+		goto out;
+	}
+
+	if ((epfd = epoll_create1(0)) < 0) {
+		perror("epoll_create1");
+		goto out;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL; /* marks the listening socket */
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev)) {
+		perror("epoll_ctl");
+		goto out;
+	}
+
+	while (!terminate) {
+		int n = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]), -1), it;
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			goto out;
+		}
+
+		for (it = 0; it < n; it++) {
+			if (events[it].data.ptr)
+				handle_connection(hsts, epfd, events[it].data.ptr, events[it].events);
+			else
+				accept_connections(epfd, listen_fd);
+		}
+	}
+
+	rc = 0;
+
+out:
+	if (epfd >= 0)
+		close(epfd);
+	close(listen_fd);
+	if (bound)
+		unlink(path);
+
+	return rc;
+}
+
+#else
+
+int hsts_serve(const hsts_t *hsts, const char *path)
+{
+	(void) hsts;
+	(void) path;
+
+	fprintf(stderr, "--serve is not supported on this platform\n");
+	return -1;
+}
+
+#endif /* HAVE_SYS_EPOLL_H */
@@ -51,6 +51,9 @@
 #  define LIBHSTS_NORETURN
 #endif
 
+/* hsts-server.c */
+int hsts_serve(const hsts_t *hsts, const char *path);
+
 LIBHSTS_NORETURN static void usage(int err, FILE* f)
 {
 	fprintf(f, "Usage: hsts [options] <domains...>\n");
@@ -58,7 +61,14 @@ LIBHSTS_NORETURN static void usage(int err, FILE* f)
 	fprintf(f, "Options:\n");
 	fprintf(f, "  --version                    show library version information\n");
 	fprintf(f, "  --load-hsts-file <filename>  load HSTS data from file (DAFSA format)\n");
+	fprintf(f, "  --max-size <bytes>           max. size of HSTS data files loaded after this option\n");
+	fprintf(f, "                               (default: 20MB)\n");
 	fprintf(f, "  --include-subdomains         check if given domains have the 'include_subdomains' flag\n");
+	fprintf(f, "  --engine <dafsa|hash>        lookup engine (default: dafsa)\n");
+	fprintf(f, "  --serve <unix-socket>        serve lookups on a unix socket\n");
+	fprintf(f, "  --analyze                    print a JSON report about the HSTS data, the given\n");
+	fprintf(f, "                               domains are used to model the lookup cost\n");
+	fprintf(f, "  --report-hits <n>            after the lookups, print the n entries with the most hits\n");
 	fprintf(f, "  -b,  --batch                 don't print leading domain\n");
 	fprintf(f, "\n");
 
@@ -87,11 +97,76 @@ static void check_and_print(const hsts_t *hsts, const char *domain, int mode)
 		printf("%s: %d\n", domain, res);
 }
 
+static void report_hits(const hsts_t *hsts, size_t n)
+{
+	hsts_hit_t *top;
+	size_t ntop, it;
+	int rc;
+
+	if ((rc = hsts_top_entries(hsts, n, &top, &ntop)) != HSTS_SUCCESS) {
+		fprintf(stderr, "Failed to get hit counts (%d)\n", rc);
+		return;
+	}
+
+	printf("# top %zu entries by hits\n", ntop);
+	for (it = 0; it < ntop; it++)
+		printf("%llu %s\n", top[it].hits, top[it].domain);
+
+	hsts_free_top_entries(top);
+}
+
+static void analyze(const hsts_t *hsts, const char *const *arg, const char *const *end)
+{
+	const char **hosts = NULL;
+	size_t nhosts = 0, size = 0;
+	int rc;
+
+	if (arg >= end && !isatty(STDIN_FILENO)) {
+		char buf[256], *domain;
+		size_t len;
+
+		/* read host sample from STDIN */
+		while (fgets(buf, sizeof(buf), stdin)) {
+			for (domain = buf; isspace(*domain); domain++); /* skip leading spaces */
+			if (*domain == '#' || !*domain) continue; /* skip empty lines and comments */
+			for (len = 0; domain[len] && !isspace(domain[len]); len++); /* take first field */
+			domain[len] = 0;
+
+			if (nhosts >= size) {
+				const char **tmp = realloc(hosts, (size = size ? size * 2 : 1024) * sizeof(char *));
+
+				if (!tmp)
+					break;
+				hosts = tmp;
+			}
+
+			if (!(hosts[nhosts] = strdup(domain)))
+				break;
+			nhosts++;
+		}
+
+		rc = hsts_analyze(hsts, hosts, nhosts, stdout);
+
+		while (nhosts)
+			free((char *) hosts[--nhosts]);
+		free(hosts);
+	} else
+		rc = hsts_analyze(hsts, (const char *const *) arg, (size_t) (end - arg), stdout);
+
+	if (rc != HSTS_SUCCESS) {
+		fprintf(stderr, "Failed to analyze HSTS data (%d)\n", rc);
+		exit(1);
+	}
+}
+
 int main(int argc, const char *const *argv)
 {
 	int mode = 1;
-	const char *const *arg, *hsts_file = NULL;
+	hsts_engine_t engine = HSTS_ENGINE_DAFSA;
+	const char *const *arg, *hsts_file = NULL, *socket_path = NULL;
 	hsts_t *hsts = NULL;
+	size_t max_size = 0, report_hits_n = 0;
+	int analyze_mode = 0;
 
 	hsts_load_file(hsts_dist_filename(), &hsts);
 
@@ -104,11 +179,33 @@ int main(int argc, const char *const *argv)
 				if (hsts_file) {
 					fprintf(stderr, "Dropped data from %s\n", hsts_file);
 				}
-				if (hsts_load_file(hsts_file = *(++arg), &hsts) != HSTS_SUCCESS) {
+				if (hsts_load_file_limit(hsts_file = *(++arg), max_size, &hsts) != HSTS_SUCCESS) {
 					fprintf(stderr, "Failed to load HSTS data from %s\n\n", hsts_file);
 					hsts_file = NULL;
 				}
 			}
+			else if (!strcmp(*arg, "--max-size") && arg < argv + argc - 1) {
+				max_size = (size_t) strtoull(*(++arg), NULL, 10);
+			}
+			else if (!strcmp(*arg, "--engine") && arg < argv + argc - 1) {
+				if (!strcmp(*(++arg), "dafsa"))
+					engine = HSTS_ENGINE_DAFSA;
+				else if (!strcmp(*arg, "hash"))
+					engine = HSTS_ENGINE_HASH;
+				else {
+					fprintf(stderr, "Unknown engine '%s'\n", *arg);
+					usage(1, stderr);
+				}
+			}
+			else if (!strcmp(*arg, "--serve") && arg < argv + argc - 1) {
+				socket_path = *(++arg);
+			}
+			else if (!strcmp(*arg, "--analyze")) {
+				analyze_mode = 1;
+			}
+			else if (!strcmp(*arg, "--report-hits") && arg < argv + argc - 1) {
+				report_hits_n = (size_t) strtoull(*(++arg), NULL, 10);
+			}
 			else if (!strcmp(*arg, "--batch") || !strcmp(*arg, "-b")) {
 				batch_mode = 1;
 			}
@@ -141,6 +238,34 @@ int main(int argc, const char *const *argv)
 		exit(2);
 	}
 
+	if (hsts_set_engine(hsts, engine) != HSTS_SUCCESS) {
+		fprintf(stderr, "Failed to set up lookup engine - aborting\n");
+		hsts_free(hsts);
+		exit(2);
+	}
+
+	if (report_hits_n && hsts_set_hit_counting(hsts, 1) != HSTS_SUCCESS) {
+		fprintf(stderr, "Failed to enable hit counting - aborting\n");
+		hsts_free(hsts);
+		exit(2);
+	}
+
+	if (socket_path) {
+		int rc = hsts_serve(hsts, socket_path);
+
+		if (report_hits_n)
+			report_hits(hsts, report_hits_n);
+
+		hsts_free(hsts);
+		exit(rc ? 1 : 0);
+	}
+
+	if (analyze_mode) {
+		analyze(hsts, arg, argv + argc);
+		hsts_free(hsts);
+		exit(0);
+	}
+
 	if (arg >= argv + argc) {
 		char buf[256], *domain;
 		size_t len;
@@ -154,14 +279,14 @@ int main(int argc, const char *const *argv)
 
 			check_and_print(hsts, domain, mode);
 		}
-
-		hsts_free(hsts);
-		exit(0);
+	} else {
+		for (; arg < argv + argc; arg++) {
+			check_and_print(hsts, *arg, mode);
+		}
 	}
 
-	for (; arg < argv + argc; arg++) {
-		check_and_print(hsts, *arg, mode);
-	}
+	if (report_hits_n)
+		report_hits(hsts, report_hits_n);
 
 	hsts_free(hsts);
 